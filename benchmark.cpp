@@ -0,0 +1,478 @@
+// benchmarks for the compressor, decompressor, CodeTable and bit iterators
+// build with: g++ -std=c++20 -O2 -pthread -o benchmark benchmark.cpp
+#include "lzw_bit.hpp"
+
+#include <chrono>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <sstream>
+
+#include <sys/resource.h>
+
+// stops the compiler from optimising away work whose result isn't otherwise used
+volatile std::uint64_t sink;
+
+// the corpora are all generated from fixed seeds, so every run benchmarks exactly the same data
+namespace corpus {
+    std::string zeros(std::size_t size) {
+        return std::string(size, '\0');
+    }
+
+    std::string random(std::size_t size) {
+        std::mt19937_64 generator(1);
+        std::string data(size, '\0');
+        for (auto& c : data) { c = (char)generator(); }
+        return data;
+    }
+
+    // bits that mostly repeat the one before, in runs averaging 16 bits long
+    std::string markov(std::size_t size) {
+        std::mt19937_64 generator(2);
+        std::bernoulli_distribution flip(1.0 / 16);
+        std::string data(size, '\0');
+        bool bit = false;
+        for (auto& c : data) {
+            for (std::size_t i = 0; i < 8; ++i) {
+                if (flip(generator)) { bit = not bit; }
+                c = (char)(c << 1 | bit);
+            }
+        }
+        return data;
+    }
+
+    // words picked with Zipf-like frequencies, with the odd bit of punctuation
+    std::string english(std::size_t size) {
+        static const char* WORDS[] = {
+            "the", "of", "and", "to", "a", "in", "is", "that", "it", "was", "for", "on", "are", "as", "with",
+            "his", "they", "at", "be", "this", "from", "have", "or", "by", "one", "had", "not", "but", "what",
+            "all", "were", "when", "we", "there", "can", "an", "your", "which", "their", "said", "if", "do",
+            "will", "each", "about", "how", "up", "out", "them", "then", "she", "many", "some", "so", "these",
+            "would", "other", "into", "has", "more", "her", "two", "like", "him", "see", "time", "could", "no",
+            "make", "than", "first", "been", "its", "who", "now", "people", "my", "made", "over", "did", "down",
+            "only", "way", "find", "use", "may", "water", "long", "little", "very", "after", "words", "called",
+            "just", "where", "most", "know", "compression", "dictionary", "string", "table",
+        };
+        constexpr std::size_t COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+        std::vector<double> weights;
+        for (std::size_t i = 0; i < COUNT; ++i) { weights.push_back(1.0 / (i + 1)); }
+        std::mt19937_64 generator(3);
+        std::discrete_distribution<std::size_t> word(weights.begin(), weights.end());
+        std::uniform_int_distribution<int> punctuation(0, 15);
+        std::string data;
+        bool capital = true;
+        while (data.size() < size) {
+            std::string next = WORDS[word(generator)];
+            if (capital) { next[0] = (char)std::toupper(next[0]); }
+            data += next;
+            int p = punctuation(generator);
+            capital = p == 0;
+            data += p == 0 ? ". " : p == 1 ? ", " : " ";
+        }
+        data.resize(size);
+        return data;
+    }
+
+    // fixed-layout little-endian records, as a database or file format might have:
+    // an incrementing id, a small category, a slowly-drifting measurement and some padding
+    std::string structured(std::size_t size) {
+        std::mt19937_64 generator(4);
+        std::string data;
+        std::uint32_t id = 1000;
+        double measurement = 20.0;
+        std::normal_distribution<double> drift(0.0, 0.1);
+        while (data.size() < size) {
+            char record[24] = {};
+            std::uint32_t category = generator() % 5;
+            measurement += drift(generator);
+            std::memcpy(record, &id, 4);
+            std::memcpy(record + 4, &category, 4);
+            std::memcpy(record + 8, &measurement, 8);
+            data.append(record, sizeof(record));
+            ++id;
+        }
+        data.resize(size);
+        return data;
+    }
+}
+
+// the peak resident set size of the process so far, in kB
+// on Linux this can be reset so that each benchmark gets its own peak, elsewhere it only ever goes up
+std::size_t peak_rss_kb() {
+    if (std::ifstream status("/proc/self/status"); status) {
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.rfind("VmHWM:", 0) == 0) { return std::stoul(line.substr(6)); }
+        }
+    }
+    struct rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+void reset_peak_rss() {
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+// runs the function repeatedly until at least min_seconds have passed (and at least once),
+// returning the fastest time taken by any one run, in seconds. setup is called before each run, and isn't timed
+template <class Setup, class Function>
+double best_time(Setup setup, Function function, double min_seconds = 0.5) {
+    using clock = std::chrono::steady_clock;
+    double best = std::numeric_limits<double>::infinity();
+    auto start = clock::now();
+    do {
+        setup();
+        auto run_start = clock::now();
+        function();
+        best = std::min(best, std::chrono::duration<double>(clock::now() - run_start).count());
+    } while (std::chrono::duration<double>(clock::now() - start).count() < min_seconds);
+    return best;
+}
+
+template <class Function>
+double best_time(Function function, double min_seconds = 0.5) {
+    return best_time([]() {}, function, min_seconds);
+}
+
+// a flat set of named values, written out as a JSON object
+struct Result {
+    std::vector<std::pair<std::string, std::string>> fields;
+
+    Result& add(const std::string& name, const std::string& value) {
+        fields.emplace_back(name, quote(value));
+        return *this;
+    }
+    Result& add(const std::string& name, double value) {
+        std::ostringstream number;
+        number << std::setprecision(12) << value;
+        fields.emplace_back(name, number.str());
+        return *this;
+    }
+    std::string json() const {
+        std::string out = "{";
+        for (std::size_t i = 0; i < fields.size(); ++i) {
+            out += (i == 0 ? "" : ", ") + quote(fields[i].first) + ": " + fields[i].second;
+        }
+        return out + "}";
+    }
+    // a JSON string literal, as corpus names come from file names, which can have anything in them
+    static std::string quote(const std::string& value) {
+        std::string quoted = "\"";
+        for (char c : value) {
+            if (c == '"' or c == '\\') {
+                quoted += '\\';
+                quoted += c;
+            } else if ((unsigned char)c < 0x20) {
+                char escape[7];
+                std::snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)c);
+                quoted += escape;
+            } else {
+                quoted += c;
+            }
+        }
+        return quoted + "\"";
+    }
+};
+
+std::vector<Result> results;
+
+// calls the function with each of the code table's engines in turn, along with its name
+template <std::size_t SYMBOL_BITS, class Function>
+void with_each_engine(Function function) {
+    function(TrieChildren<SYMBOL_BITS>(), "trie");
+    function(HashChildren<SYMBOL_BITS>(), "hash");
+}
+
+// the fastest time taken by each engine for each benchmark run with both, to say which wins
+std::map<std::string, std::map<std::string, double>> engine_times;
+
+// decompresses through the push-style interface a few bytes in and out at a time, so that codes are split
+// across calls and held back while output is full, which has to come out the same as decompressing it all at once
+template <std::size_t SYMBOL_BITS, class Children>
+bool push_round_trip(const std::string& compressed, const std::string& data, const StreamHeader& header) {
+    LzwBitDecoder<SYMBOL_BITS, Children> decoder(header.limit, header.packing, header.elimination);
+    std::mt19937_64 generator(6);
+    std::span<const std::byte> input((const std::byte*)compressed.data(), compressed.size());
+    std::string output;
+    std::byte buffer[3];
+    while (not input.empty() and not decoder.done()) {
+        auto progress = decoder.write(input.first(std::min<std::size_t>(input.size(), 1 + generator() % 7)), std::span(buffer, 1 + generator() % 3));
+        output.append((const char*)buffer, progress.produced);
+        input = input.subspan(progress.consumed);
+    }
+    do {
+        output.append((const char*)buffer, decoder.finish(std::span(buffer, 1 + generator() % 3)));
+    } while (decoder.pending());
+    return decoder.error() == DecodeError::NONE and output == data;
+}
+
+template <std::size_t SYMBOL_BITS, class Children>
+void benchmark_codec(const std::string& corpus_name, const std::string& data, const StreamHeader& header, const char* engine) {
+    std::string compressed;
+    std::string decompressed;
+    reset_peak_rss();
+    double compress_time = best_time([&]() {
+        compressed.clear();
+        lzw_bit_compress<SYMBOL_BITS, Children>(data.begin(), data.end(), std::back_inserter(compressed), header.limit, header.packing, header.elimination);
+    });
+    std::size_t compress_rss = peak_rss_kb();
+    reset_peak_rss();
+    double decompress_time = best_time([&]() {
+        decompressed.clear();
+        lzw_bit_decompress<SYMBOL_BITS, Children>(compressed.begin(), compressed.end(), std::back_inserter(decompressed), header.limit, header.packing, header.elimination);
+    });
+    std::size_t decompress_rss = peak_rss_kb();
+    if (decompressed != data or not push_round_trip<SYMBOL_BITS, Children>(compressed, data, header)) {
+        std::cerr << "Round trip failed for " << corpus_name << "!" << std::endl;
+        std::exit(1);
+    }
+    double ratio = data.empty() ? 0.0 : (double)compressed.size() / data.size();
+    std::size_t entries = header.limit.policy == DictionaryPolicy::UNBOUNDED ? 0 : header.limit.max_entries;
+    for (auto [name, seconds, rss] : {std::tuple("compress", compress_time, compress_rss), std::tuple("decompress", decompress_time, decompress_rss)}) {
+        double mb_per_s = data.size() / seconds / 1e6;
+        double ns_per_bit = seconds * 1e9 / (data.size() * 8.0);
+        std::printf("%-10s %-12s %10zu %2zu %-4s %8zu %10.2f MB/s %8.2f ns/bit %8zu kB %6.1f%%\n",
+                    name, corpus_name.c_str(), data.size(), SYMBOL_BITS, engine, entries, mb_per_s, ns_per_bit, rss, ratio * 100);
+        results.push_back(Result().add("benchmark", name).add("corpus", corpus_name).add("size", data.size())
+                          .add("symbol_bits", SYMBOL_BITS).add("engine", engine).add("max_entries", entries)
+                          .add("seconds", seconds).add("mb_per_s", mb_per_s)
+                          .add("ns_per_bit", ns_per_bit).add("peak_rss_kb", rss).add("ratio", ratio));
+        std::ostringstream key;
+        key << std::left << std::setw(10) << name << " " << std::setw(12) << corpus_name << " " << std::right << std::setw(10) << data.size()
+            << " " << std::setw(2) << SYMBOL_BITS << " " << std::setw(8) << entries;
+        engine_times[key.str()][engine] = seconds;
+    }
+}
+
+// prints which engine was quickest at each benchmark, and by how much
+void report_engines() {
+    std::printf("\n%-10s %-12s %10s %2s %8s  quickest engine\n", "", "corpus", "size", "w", "entries");
+    for (const auto& [key, times] : engine_times) {
+        auto quickest = std::min_element(times.begin(), times.end(), [](const auto& a, const auto& b) { return a.second < b.second; });
+        double slowest = std::max_element(times.begin(), times.end(), [](const auto& a, const auto& b) { return a.second < b.second; })->second;
+        std::printf("%s  %s, %.2fx\n", key.c_str(), quickest->first.c_str(), slowest / quickest->second);
+    }
+}
+
+void report_micro(const std::string& name, std::size_t symbol_bits, std::size_t operations, double seconds) {
+    double ns_per_op = seconds * 1e9 / operations;
+    std::printf("%-32s %2zu %10zu ops %10.2f ns/op\n", name.c_str(), symbol_bits, operations, ns_per_op);
+    results.push_back(Result().add("benchmark", name).add("symbol_bits", symbol_bits).add("operations", operations)
+                      .add("seconds", seconds).add("ns_per_op", ns_per_op));
+}
+
+// times the string-based CodeTable interface, growing a table by the given number of strings
+template <std::size_t SYMBOL_BITS, class Children>
+void benchmark_code_table(std::size_t count, const std::string& engine) {
+    using Table = CodeTable<SYMBOL_BITS, Children>;
+    std::mt19937_64 generator(5);
+    // work out a set of strings to add up front, each extending one added before it, as LZW would
+    std::vector<typename Table::String> strings;
+    for (std::size_t c = 0; c < Table::ALPHABET_SIZE; ++c) { strings.push_back({(typename Table::Symbol)c}); }
+    {
+        Table reference;
+        while (strings.size() < count + Table::ALPHABET_SIZE) {
+            auto next = strings[generator() % strings.size()];
+            next.push_back((typename Table::Symbol)(generator() % Table::ALPHABET_SIZE));
+            if (reference.contains(next)) { continue; }
+            reference += next;
+            strings.push_back(next);
+        }
+    }
+    Table table;
+    report_micro("CodeTable<" + engine + ">::operator+=", SYMBOL_BITS, count, best_time([&]() { table = Table(); }, [&]() {
+        for (std::size_t i = Table::ALPHABET_SIZE; i < strings.size(); ++i) { table += strings[i]; }
+    }));
+    report_micro("CodeTable<" + engine + ">::find(string)", SYMBOL_BITS, strings.size(), best_time([&]() {
+        std::uint64_t found = 0;
+        for (const auto& string : strings) { found += *table.find(string); }
+        sink = found;
+    }));
+    std::vector<std::size_t> codewords(strings.size());
+    for (auto& codeword : codewords) { codeword = generator() % table.size(); }
+    report_micro("CodeTable<" + engine + ">::find(codeword)", SYMBOL_BITS, codewords.size(), best_time([&]() {
+        std::uint64_t found = 0;
+        for (auto codeword : codewords) { found += *table.find(codeword); }
+        sink = found;
+    }));
+    // uncode half the table, a random codeword at a time
+    std::size_t removals = table.size() / 2;
+    for (std::size_t i = 0; i < removals; ++i) { codewords[i] = generator() % (table.size() - i); }
+    Table copy;
+    report_micro("CodeTable<" + engine + ">::operator-=", SYMBOL_BITS, removals, best_time([&]() { copy = table; }, [&]() {
+        for (std::size_t i = 0; i < removals; ++i) { copy -= codewords[i]; }
+        sink = copy.size();
+    }));
+}
+
+void benchmark_bit_iterators(std::size_t bytes) {
+    std::string data = corpus::random(bytes);
+    std::size_t bits = bytes * 8;
+    report_micro("char_bit_input_iterator", 1, bits, best_time([&]() {
+        std::istringstream input(data);
+        auto reader = std::istreambuf_iterator<char>(input);
+        std::uint64_t ones = 0;
+        for (char_bit_input_iterator<std::istreambuf_iterator, char> it(reader), end; it != end; ++it) { ones += *it; }
+        sink = ones;
+    }));
+    report_micro("char_bit_output_iterator", 1, bits, best_time([&]() {
+        std::ostringstream output;
+        auto writer = std::ostreambuf_iterator<char>(output);
+        {
+            char_bit_output_iterator<std::ostreambuf_iterator, char> it(writer);
+            for (std::size_t i = 0; i < bits; ++i) { *it = (bool)(i & 1); }
+        }
+        sink = output.str().size();
+    }));
+    for (std::size_t width : {1, 13}) {
+        std::size_t count = bits / width;
+        report_micro("bit_reader::get_bits(" + std::to_string(width) + ")", width, count, best_time([&]() {
+            bit_reader reader(data.begin(), data.end());
+            std::uint64_t total = 0;
+            for (std::size_t i = 0; i < count; ++i) { total += *reader.get_bits(width); }
+            sink = total;
+        }));
+        report_micro("bit_writer::put_bits(" + std::to_string(width) + ")", width, count, best_time([&]() {
+            std::string output;
+            output.reserve(bytes);
+            bit_writer writer(std::back_inserter(output));
+            std::uint64_t mask = (std::uint64_t(1) << width) - 1;
+            for (std::size_t i = 0; i < count; ++i) { writer.put_bits(i & mask, width); }
+            writer.flush();
+            sink = output.size();
+        }));
+    }
+}
+
+// splits a comma-separated list of numbers
+std::vector<std::size_t> parse_list(const std::string& list) {
+    std::vector<std::size_t> values;
+    std::istringstream stream(list);
+    for (std::string item; std::getline(stream, item, ',');) { values.push_back(std::stoul(item)); }
+    return values;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::size_t> sizes = {64 << 10, 1 << 20};
+    std::vector<std::size_t> widths = {1, 8};
+    std::vector<std::size_t> limits = {0};
+    std::string output_path = "benchmark.json";
+    StreamHeader header;
+    bool micro = true;
+    bool valid = true;
+    // any other arguments are files to use as real-world corpora alongside the generated ones
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-s" and i + 1 < argc) {
+            sizes = parse_list(argv[++i]);
+        } else if (arg == "-w" and i + 1 < argc) {
+            widths = parse_list(argv[++i]);
+        } else if (arg == "-m" and i + 1 < argc) {
+            limits = parse_list(argv[++i]);
+        } else if (arg == "-p" and i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "freeze") {
+                header.limit.policy = DictionaryPolicy::FREEZE;
+            } else if (name == "reset") {
+                header.limit.policy = DictionaryPolicy::RESET;
+            } else if (name == "prune") {
+                header.limit.policy = DictionaryPolicy::PRUNE;
+            } else {
+                valid = false;
+            }
+        } else if (arg == "-o" and i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (arg == "-k" and i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "binary") {
+                header.packing = CodewordPacking::BINARY;
+            } else if (name == "phase-in") {
+                header.packing = CodewordPacking::PHASE_IN;
+            } else if (name == "dense") {
+                header.packing = CodewordPacking::DENSE;
+            } else {
+                valid = false;
+            }
+        } else if (arg == "-r" and i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "immediate") {
+                header.elimination = RedundantCodeElimination::IMMEDIATE;
+            } else if (name == "batched") {
+                header.elimination = RedundantCodeElimination::BATCHED;
+            } else if (name == "none") {
+                header.elimination = RedundantCodeElimination::NONE;
+            } else {
+                valid = false;
+            }
+        } else if (arg == "-C") {
+            micro = false;
+        } else if (arg.size() > 1 and arg[0] == '-') {
+            valid = false;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (not valid) {
+        std::cerr << "Usage: " << argv[0] << " [-s <sizes>] [-w <widths>] [-m <entries>] [-p freeze|reset|prune] [-k binary|phase-in|dense] [-r immediate|batched|none] [-C] [-o <results file>] [<corpus file>...]" << std::endl;
+        std::cerr << "  -s  comma-separated sizes in bytes of the generated corpora (default 65536,1048576)" << std::endl;
+        std::cerr << "  -w  comma-separated symbol widths to benchmark (default 1,8)" << std::endl;
+        std::cerr << "  -m  comma-separated code table limits, 0 for none (default 0)" << std::endl;
+        std::cerr << "  -p  what to do when the code table is full (default freeze)" << std::endl;
+        std::cerr << "  -k  how codewords are packed into bits (default binary)" << std::endl;
+        std::cerr << "  -r  when shadowed codes are dropped from the code table (default immediate)" << std::endl;
+        std::cerr << "  -C  only benchmark the compressor and decompressor, not the micro-benchmarks" << std::endl;
+        std::cerr << "  -o  where to write the results as JSON (default benchmark.json)" << std::endl;
+        return 1;
+    }
+    std::vector<std::pair<std::string, std::string (*)(std::size_t)>> generators = {
+        {"zeros", corpus::zeros}, {"random", corpus::random}, {"markov", corpus::markov},
+        {"english", corpus::english}, {"structured", corpus::structured},
+    };
+    std::vector<std::pair<std::string, std::string>> corpora;
+    for (auto size : sizes) {
+        for (auto& [name, generate] : generators) { corpora.emplace_back(name, generate(size)); }
+    }
+    for (const auto& path : files) {
+        std::ifstream file(path, std::ifstream::binary);
+        corpora.emplace_back(std::filesystem::path(path).filename().string(), std::string(std::istreambuf_iterator<char>(file), {}));
+    }
+    // the policy only applies when there's a limit
+    DictionaryPolicy policy = header.limit.policy == DictionaryPolicy::UNBOUNDED ? DictionaryPolicy::FREEZE : header.limit.policy;
+    for (auto width : widths) {
+        for (auto entries : limits) {
+            // the table can't hold less than the 1-symbol strings it starts with
+            if (entries != 0 and entries < ((std::size_t)1 << width)) { continue; }
+            header.limit = entries == 0 ? DictionaryLimit() : DictionaryLimit{policy, entries};
+            for (const auto& [name, data] : corpora) {
+                with_symbol_bits(width, [&](auto bits) {
+                    with_each_engine<bits>([&](auto engine, const char* engine_name) {
+                        benchmark_codec<bits, decltype(engine)>(name, data, header, engine_name);
+                    });
+                });
+            }
+        }
+    }
+    report_engines();
+    if (micro) {
+        for (auto width : widths) {
+            with_symbol_bits(width, [&](auto bits) {
+                with_each_engine<bits>([&](auto engine, const char* engine_name) { benchmark_code_table<bits, decltype(engine)>(100000, engine_name); });
+            });
+        }
+        benchmark_bit_iterators(1 << 20);
+    }
+    std::ofstream output(output_path);
+    output << "{\"timestamp\": " << std::time(nullptr) << ", \"results\": [" << std::endl;
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        output << "  " << results[i].json() << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    output << "]}" << std::endl;
+}
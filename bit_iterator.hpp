@@ -1,10 +1,15 @@
+#pragma once
+
+#include <bit>
 #include <fstream>
 #include <iostream>
 #include <iterator>
 #include <limits>
+#include <optional>
 #include <type_traits>
 
 #include <cstddef>
+#include <cstdint>
 
 template <template<class> class CharInputIterator, class CharT>
 struct char_bit_input_iterator {
@@ -168,6 +173,134 @@ private:
     char_type _current_char = 0;
 };
 
+// the number of bits needed to write any value in [0, space_size), i.e. ceil(log2(space_size))
+constexpr std::size_t bits_needed(std::uintmax_t space_size) {
+    return space_size > 1 ? std::bit_width(space_size - 1) : 0;
+}
+
+// writes variable-width values to a char output iterator as a big-endian bitstream
+// bits are gathered in a 64-bit accumulator and sent on a whole word at a time,
+// which is much cheaper than going through char_bit_output_iterator a bit at a time
+template <class CharOutputIterator>
+class bit_writer {
+public:
+    constexpr bit_writer(CharOutputIterator result) : _wrapped_iterator(result) {}
+    // write the low `width` bits of value, most significant first. width can be up to 64
+    // NOTE: value must not have any bits set above the low `width` bits
+    constexpr void put_bits(std::uint64_t value, std::size_t width) {
+        if (_count + width < WORD_BITS) {
+            // width can't be 64 here, so this shift is safe
+            _buffer = _buffer << width | value;
+            _count += width;
+            return;
+        }
+        // the word fills up --the top of value completes it and the rest stays behind
+        std::size_t rest = _count + width - WORD_BITS;
+        _write_word((_count == 0 ? 0 : _buffer << (WORD_BITS - _count)) | value >> rest);
+        _buffer = rest == 0 ? 0 : value & (~std::uint64_t(0) >> (WORD_BITS - rest));
+        _count = rest;
+    }
+    // send out all the whole chars held, keeping back any bits of a partial one
+    constexpr void flush_whole_chars() {
+        for (; _count >= BITS_PER_CHAR; _count -= BITS_PER_CHAR) {
+            *_wrapped_iterator = (char)(_buffer >> (_count - BITS_PER_CHAR));
+            ++_wrapped_iterator;
+        }
+        _buffer &= ~(~std::uint64_t(0) << _count);
+    }
+    // send out any bits still held, padding the last char with 0s, and return the wrapped iterator
+    constexpr CharOutputIterator flush() {
+        // left-align what's held so that it goes out in the same order as a whole word would
+        std::uint64_t word = _count == 0 ? 0 : _buffer << (WORD_BITS - _count);
+        for (std::size_t written = 0; written < _count; written += BITS_PER_CHAR) {
+            *_wrapped_iterator = (char)(word >> (WORD_BITS - BITS_PER_CHAR));
+            ++_wrapped_iterator;
+            word <<= BITS_PER_CHAR;
+        }
+        _buffer = 0;
+        _count = 0;
+        return _wrapped_iterator;
+    }
+
+private:
+    constexpr void _write_word(std::uint64_t word) {
+        for (std::size_t shift = WORD_BITS; shift > 0; shift -= BITS_PER_CHAR) {
+            *_wrapped_iterator = (char)(word >> (shift - BITS_PER_CHAR));
+            ++_wrapped_iterator;
+        }
+    }
+
+    static constexpr std::size_t WORD_BITS = 64;
+    static constexpr std::size_t BITS_PER_CHAR = (std::size_t)std::numeric_limits<unsigned char>::digits;
+    CharOutputIterator _wrapped_iterator;
+    // the last _count bits written, right-aligned
+    std::uint64_t _buffer = 0;
+    std::size_t _count = 0;
+};
+
+// reads variable-width values from a char input iterator as a big-endian bitstream
+// the counterpart to bit_writer, this refills a 64-bit accumulator as it runs low
+template <class CharInputIterator>
+class bit_reader {
+public:
+    // the most bits that can be read at once
+    static constexpr std::size_t MAX_WIDTH = 56;
+
+    constexpr bit_reader(CharInputIterator first, CharInputIterator last) : _first(first), _last(last) {}
+    // read the next `width` bits (up to MAX_WIDTH) as a value, most significant first,
+    // or nullopt if the stream ends before that many bits can be read.
+    constexpr std::optional<std::uint64_t> get_bits(std::size_t width) {
+        auto value = peek_bits(width);
+        if (value) { _count -= width; }
+        return value;
+    }
+    // like get_bits(), but leaves the bits to be read again
+    constexpr std::optional<std::uint64_t> peek_bits(std::size_t width) {
+        if (_count < width) {
+            _refill();
+            if (_count < width) { return std::nullopt; }
+        }
+        if (width == 0) { return 0; }
+        return (_buffer >> (_count - width)) & (~std::uint64_t(0) >> (WORD_BITS - width));
+    }
+    // move past bits that have already been peeked at
+    constexpr void skip_bits(std::size_t width) {
+        _count -= width;
+    }
+    // carry on reading from a new range, keeping any bits already held from the old one
+    constexpr void feed(CharInputIterator first, CharInputIterator last) {
+        _first = first;
+        _last = last;
+    }
+    // whether all bits have been read
+    constexpr bool empty() {
+        _refill();
+        return _count == 0;
+    }
+    // the position in the wrapped stream just after the last char that was pulled into the accumulator
+    constexpr CharInputIterator position() const {
+        return _first;
+    }
+
+private:
+    // top the accumulator up with as many whole chars as will fit
+    constexpr void _refill() {
+        while (_count <= MAX_WIDTH and _first != _last) {
+            _buffer = _buffer << BITS_PER_CHAR | (unsigned char)*_first;
+            ++_first;
+            _count += BITS_PER_CHAR;
+        }
+    }
+
+    static constexpr std::size_t WORD_BITS = 64;
+    static constexpr std::size_t BITS_PER_CHAR = (std::size_t)std::numeric_limits<unsigned char>::digits;
+    CharInputIterator _first;
+    CharInputIterator _last;
+    // the next _count bits to be read, right-aligned
+    std::uint64_t _buffer = 0;
+    std::size_t _count = 0;
+};
+
 // int main(int, char* argv[]) {
 //     std::ifstream program_source(argv[1], std::ifstream::binary);
 //     auto file_reader = std::istreambuf_iterator<char>(program_source);
@@ -1,380 +1,1259 @@
-#include <iostream>
-#include <unordered_map>
-#include <vector>
+#include "lzw_bit.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+
+#include <random>
+
 
 template <class Iterable>
-void print_bits(Iterable bits) {
+void print(Iterable bits) {
     for (auto bit : bits) {
-        std::cout << bit;
+        std::cout << bit << " ";
     }
+    std::cout << std::endl;
 }
 
-#include <cmath>
+#include <fstream>
 
-std::vector<bool> serialise_for(uintmax_t symbol, std::size_t space_size) {
-    // std::cout << "serialise_for(" << symbol << ", " << space_size << ")" << std::endl;
-    std::size_t bits_needed = std::ceil(std::log2(space_size));
-    std::vector<bool> output;
-    for (std::uintmax_t p = 1 << (bits_needed - 1); p > 1; p >>= 1) {
-        if (symbol & p) {
-            output.push_back(1);
-            symbol -= p;
-        } else {
-            output.push_back(0);
-        }
+#include "mapped_file.hpp"
+
+// runs the compressor or decompressor with the given symbol width over a range of chars
+template <std::size_t SYMBOL_BITS, class InputIterator, class OutputIterator>
+OutputIterator run(char mode, const StreamHeader& header, InputIterator first, InputIterator last, OutputIterator result) {
+    if (mode == 'c') {
+        return lzw_bit_compress<SYMBOL_BITS>(first, last, result, header.limit, header.packing, header.elimination, header.preset);
+    } else {
+        return lzw_bit_decompress<SYMBOL_BITS>(first, last, result, header.limit, header.packing, header.elimination, header.preset);
     }
-    output.push_back(symbol);
-    return output;
 }
 
-uintmax_t deserialise(std::vector<bool> bits) {
-    uintmax_t result = 0;
-    for (auto bit : bits) {
-        result <<= 1;
-        result |= bit;
+// writes (when compressing) or skips over (when decompressing) the header, and runs the
+// compressor or decompressor over the single stream of codes that follows it,
+// returning why decompressing stopped early, if it did
+template <std::size_t SYMBOL_BITS, class InputIterator, class OutputIterator>
+DecodeError run_stream(char mode, const StreamHeader& header, InputIterator first, InputIterator last, OutputIterator result) {
+    if (mode == 'c') {
+        result = header.write(result);
+        run<SYMBOL_BITS>(mode, header, first, last, result);
+        return DecodeError::NONE;
+    }
+    StreamHeader::read(first, last);
+    return lzw_bit_decompress_checked<SYMBOL_BITS>(first, last, result, {}, header.limit, header.packing, header.elimination, header.preset).second;
+}
+
+// builds a preset dictionary out of whatever a code table with the given limit learns from compressing
+// the sample, writing it out and returning its id
+template <std::size_t SYMBOL_BITS, class InputIterator, class OutputIterator>
+std::uint32_t train_dictionary(InputIterator first, InputIterator last, OutputIterator result, DictionaryLimit limit) {
+    LzwBitEncoder<SYMBOL_BITS> encoder(limit);
+    // only the table is wanted, not the codewords
+    std::vector<char> discarded;
+    bit_writer output(std::back_inserter(discarded));
+    for (; first != last; ++first) {
+        encoder.encode_byte((std::uint8_t)*first, output);
     }
-    return result;
+    return encoder.string_table().save(result);
 }
 
-#include <algorithm>
-#include <deque>
-#include <memory>
-#include <optional>
+#include <string>
+#include <string_view>
 
-class CodeTable {
-public:
-    // B+ tree we use for storing the code table nodes --this is most useful for converting strings to codewords
-    struct Node {
-        Node* parent; // non-owning ref to parent, only tree parent has none
-        std::shared_ptr<Node> children[2]; // owning refs to children for 0 and 1 paths
-        std::weak_ptr<Node> next; // non-owning ref to next node, if any --regardless of whether next node is coded or not
-        bool bit; // the bit in the string at the position represented by this node
-        std::optional<std::size_t> codeword; // only allowed if not both children exist, else forbidden
-        std::size_t length; // how many bits long is the bitstring whose end is marked by this node
-
-        // ctor for use in building the special non-bit node that represents the trunk of the tree
-        Node()
-          : children{std::make_shared<Node>(this, 0, 0), std::make_shared<Node>(this, 1, 1)}
-          , length(0) {
-            children[0]->next = children[1];
-        }
-        // ctor for use when initialising the code table with first two entries or adding new entries
-        Node(Node* parent, bool bit, std::size_t codeword, std::size_t length=1)
-          : parent(parent)
-          , bit(bit)
-          , codeword(codeword)
-          , length(length)
-          {}
-        // ease of access of the node for the next bit
-        std::shared_ptr<Node> operator[](bool bit) {
-            return children[bit];
-        }
-        // get the bitstring for this node
-        std::vector<bool> bitstring() const {
-            std::vector<bool> bits(length);
-            const Node* cursor = this;
-            // WARN: this loop will segfault if length is not correct!
-            for (auto it = bits.rbegin(); it != bits.rend(); ++it) {
-                *it = cursor->bit;
-                cursor = cursor->parent;
+// compresses or decompresses a whole in-memory block on its own, with a fresh code table
+std::string run_block(char mode, const StreamHeader& header, std::string_view block) {
+    std::string output;
+    with_symbol_bits(header.symbol_bits, [&](auto bits) {
+        run<bits>(mode, header, block.begin(), block.end(), std::back_inserter(output));
+    });
+    return output;
+}
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// calls produce(i) for every i in [0, count) spread across the given number of threads, and
+// hands each result to consume(i, result) on the calling thread in order of i.
+// threads claim the next outstanding i as soon as they're free, so uneven work balances out,
+// but no more than `window` results are ever held waiting to be consumed at once.
+template <class Produce, class Consume>
+void parallel_ordered(std::size_t count, std::size_t threads, std::size_t window, Produce produce, Consume consume) {
+    using Result = decltype(produce(std::size_t()));
+    std::vector<std::optional<Result>> slots(window);
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::size_t next = 0; // next i to be claimed by a worker
+    std::size_t consumed = 0; // how many results have been consumed so far
+    auto worker = [&]() {
+        while (true) {
+            std::size_t i;
+            {
+                std::unique_lock lock(mutex);
+                changed.wait(lock, [&]() { return next >= count or next < consumed + window; });
+                if (next >= count) { return; }
+                i = next++;
             }
-            return bits;
+            Result result = produce(i);
+            std::lock_guard lock(mutex);
+            slots[i % window] = std::move(result);
+            changed.notify_all();
         }
     };
-    // type declaration for the "other side" of the lookup --converting codewords to strings
-    using LookupTable = std::deque<std::shared_ptr<Node>>;
-    // default constructor, auto-initialises a code table with all 1-bit strings
-    // and a special "EOF" symbol
-    CodeTable() : _index{_tree->children[0], _tree->children[1]} {}
-    // use codetable += <bit string> to add a code to the table
-    CodeTable& operator+=(const std::vector<bool>& string) {
-        // XXX: not checking if code already is present, BE CAREFUL!
-        auto prefix = string;
-        prefix.pop_back();
-        if (auto previous = find(prefix)) {
-            bool bit = string.back();
-            // WARN: this *WILL* overwrite existing nodes if not used correctly
-            auto new_node = std::make_shared<Node>(previous.get(), bit, _index.size(), string.size());
-            previous->children[bit] = new_node;
-            // link previous last Node to this new one
-            _index.back()->next = new_node;
-            _index.push_back(new_node);
-            // XXX: Optimisation, identify any "shadowed" redundant codes from table
-            if (previous->codeword.has_value() and previous->children[!bit]) {
-                _redundant_codes.push_back(previous->codeword.value());
-            }
-        } else {
-            std::cerr << "FATAL ERROR --tried to add new code not prefixed by anything" << std::endl;
-        }
-        return *this;
-    }
-    // find by string, may return empty pointer
-    std::shared_ptr<Node> find(const std::vector<bool>& string) {
-        std::shared_ptr<Node> cursor = _tree;
-        for (auto bit : string) {
-            cursor = cursor->children[bit];
-            if (not cursor) { break; }
-        }
-        return cursor;
-    }
-    // find by codeword, may return empty pointer
-    std::shared_ptr<Node> find(std::size_t codeword) {
-        if (codeword > _index.size() - 1) { return {}; }
-        return _index[codeword];
-    }
-    // remove the code for the given string from the table
-    // NOTE: the string remains present in the table but is now uncoded
-    CodeTable& operator-=(std::size_t codeword) {
-        auto entry = _index[codeword];
-        // uncode the entry
-        _index.erase(_index.begin() + codeword);
-        entry->codeword = std::nullopt;
-        // now advance through the rest of the entries after and reduce the codeword value for any that are uncoded
-        for (auto next = entry->next.lock(); next; next = next->next.lock()) {
-            if (next->codeword.has_value()) { next->codeword = next->codeword.value() - 1; }
-        }
-        return *this;
-    }
-    // check to see if a string is in the table
-    bool contains(const std::vector<bool>& string) {
-        return (bool)find(string);
-    }
-    // check to see if a code is in the table
-    bool contains(std::size_t codeword) {
-        return codeword < _index.size();
-    }
-    // retrieve the codeword for the given bit string, or std::nullopt if the codeword is uncoded
-    // (NOTE if it's not present at all, which is different to "uncoded", an error is raised)
-    // NOTE: using optional here is just for debugging, it should never return nullopt if our theory is correct
-    // TODO: remove it later and error if it can't be found
-    std::optional<std::size_t> operator[](const std::vector<bool>& string) {
-        return find(string)->codeword;
-    }
-    // retrieve the bit-string encoded by the given codeword
-    std::vector<bool> operator[](std::size_t codeword) {
-        return find(codeword)->bitstring();
-    }
-    // uncodes the least recently identified redundant code
-    void drop_oldest_redundant_code() {
-        if (not _redundant_codes.empty()) {
-            *this -= _redundant_codes.front();
-            _redundant_codes.pop_front();
-        }
-    }
-    // give codes back to any uncoded (dropped) strings from the table
-    // NOTE: strings are not guaranteed to get back their original codewords
-    void restore_dropped_codes() {
-        // simplest thing to do is just re-fill the codewords with successive values
-        std::size_t i = 0;
-        _index.clear();
-        for (auto cursor = _tree->children[0]; cursor; cursor = cursor->next.lock()) {
-            cursor->codeword = i;
-            _index.push_back(cursor);
-            ++i;
-        }
-    }
-    // returns the number of *coded* strings in the table. This can be less than
-    // the total number of strings stored in the table, if for example any have
-    // been uncoded.
-    // Knowing the number of assigned codes is essential for serialising and
-    // deserialising codewords in a space-efficient way.
-    std::size_t size() const {
-        return _index.size(); // index only stores entries for coded strings
-    }
-    void print() const {
-        std::cout << "==========================================" << std::endl;
-        for (auto entry = _tree->children[0]; entry; entry = entry->next.lock()) {
-            if (entry->codeword.has_value()) {
-                std::cout << entry->codeword.value();
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < std::min(threads, count); ++t) {
+        workers.emplace_back(worker);
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        Result result;
+        {
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [&]() { return slots[i % window].has_value(); });
+            result = std::move(*slots[i % window]);
+            slots[i % window].reset();
+            ++consumed;
+            changed.notify_all();
+        }
+        consume(i, std::move(result));
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+}
+
+// index of a block-compressed file, which is written after all the blocks
+// it's followed by a fixed-size trailer giving where the index starts and how many blocks there are
+struct BlockIndex {
+    std::vector<std::uint64_t> offsets; // where each block's codes start in the compressed file
+    std::vector<std::uint64_t> sizes; // how many bytes each block decompresses to
+    std::uint64_t end = 0; // where the last block's codes end, which is also where the index starts
+
+    static constexpr std::size_t ENTRY_SIZE = 16;
+    static constexpr std::size_t TRAILER_SIZE = 16;
+
+    template <class OutputIterator>
+    OutputIterator write(OutputIterator result) const {
+        for (std::size_t i = 0; i < offsets.size(); ++i) {
+            result = write_big_endian(result, offsets[i], 8);
+            result = write_big_endian(result, sizes[i], 8);
+        }
+        result = write_big_endian(result, end, 8);
+        return write_big_endian(result, offsets.size(), 8);
+    }
+    // reads the index from the end of a seekable compressed file, or nullopt if it's not valid
+    static std::optional<BlockIndex> read(std::istream& input) {
+        input.seekg(0, std::ios::end);
+        std::uint64_t file_size = input.tellg();
+        if (file_size < StreamHeader::SIZE + TRAILER_SIZE) { return std::nullopt; }
+        char trailer[TRAILER_SIZE];
+        input.seekg(file_size - TRAILER_SIZE);
+        if (not input.read(trailer, TRAILER_SIZE)) { return std::nullopt; }
+        const char* cursor = trailer;
+        const char* trailer_end = trailer + TRAILER_SIZE;
+        BlockIndex index;
+        index.end = *read_big_endian(cursor, trailer_end, 8);
+        std::uint64_t count = *read_big_endian(cursor, trailer_end, 8);
+        if (index.end < StreamHeader::SIZE or index.end > file_size - TRAILER_SIZE or (file_size - TRAILER_SIZE - index.end) / ENTRY_SIZE != count) {
+            return std::nullopt;
+        }
+        std::string entries(count * ENTRY_SIZE, '\0');
+        input.seekg(index.end);
+        if (not input.read(entries.data(), entries.size())) { return std::nullopt; }
+        cursor = entries.data();
+        const char* entries_end = entries.data() + entries.size();
+        for (std::uint64_t i = 0; i < count; ++i) {
+            index.offsets.push_back(*read_big_endian(cursor, entries_end, 8));
+            index.sizes.push_back(*read_big_endian(cursor, entries_end, 8));
+            std::uint64_t block_end = i + 1 < count ? 0 : index.end;
+            if (index.offsets[i] < (i == 0 ? StreamHeader::SIZE : index.offsets[i - 1]) or (block_end != 0 and index.offsets[i] > block_end)) {
+                return std::nullopt;
             }
-            std::cout << "\t";
-            print_bits(entry->bitstring());
-            std::cout << std::endl;
         }
+        return index;
+    }
+    // the range of compressed bytes taken up by the given block
+    std::pair<std::uint64_t, std::uint64_t> compressed_range(std::size_t block) const {
+        return {offsets[block], block + 1 < offsets.size() ? offsets[block + 1] : end};
     }
-private:
-    // useful for converting strings to codewords, and stores the actual code table
-    std::shared_ptr<Node> _tree = std::make_shared<Node>();
-    // used only for converting codewords to strings, and is non-owning, relying upon the tree for storage
-    LookupTable _index;
-    // sequence of codes for future removal
-    // TODO: consider converting to optional of just one element, don't think we'll ever have more than one at a time?
-    std::deque<std::size_t> _redundant_codes;
 };
 
-template <class InputIterator, class OutputIterator>
-OutputIterator lzw_bit_compress(InputIterator first, InputIterator last, OutputIterator result) {
-    CodeTable string_table;
-    std::vector<bool> p;
-    for (; first != last; ++first) {
-        // string_table.print();
-        bool c = *first;
-        std::vector<bool> pc = p;
-        pc.push_back(c);
-        if (string_table.contains(pc)) {
-            p = pc;
-        } else {
-            // print_bits(p);
-            // std::cout << " -> ";
-            // NOTE: +1 is to account for the special "END" symbol, not in table
-            for (auto bit : serialise_for(*string_table[p], string_table.size() + 1)) {
-                // std::cout << bit;
-                *result = bit;
-                ++result;
+#include <filesystem>
+
+// the limited table size adaptive files try, unless a limit is given
+constexpr std::size_t ADAPTIVE_PRUNED_ENTRIES = 4096;
+
+// the settings an adaptive file's blocks are each trial-compressed with: every combination of the symbol
+// widths, redundant code elimination modes and dictionary limits given, and the rest of the settings as in the header
+std::vector<StreamHeader> adaptive_candidates(const StreamHeader& header, const std::vector<std::size_t>& widths,
+    const std::vector<RedundantCodeElimination>& eliminations, const std::vector<DictionaryLimit>& limits) {
+    std::vector<StreamHeader> candidates;
+    for (std::size_t width : widths) {
+        for (auto elimination : eliminations) {
+            for (auto limit : limits) {
+                // the table can't hold less than the 1-symbol strings it starts with
+                if (limit.policy != DictionaryPolicy::UNBOUNDED and limit.max_entries < ((std::size_t)1 << width)) { continue; }
+                StreamHeader candidate = header;
+                candidate.symbol_bits = width;
+                candidate.elimination = elimination;
+                candidate.limit = limit;
+                // nor can it be full of the preset dictionary from the start
+                if (not candidate.leaves_room(header.preset)) { continue; }
+                candidates.push_back(candidate);
             }
-            // std::cout << std::endl;
-            string_table.drop_oldest_redundant_code();
-            // NOTE: If you want to restrict the string table size, here's where you'd do it
-            // FIME: Currently, there is no restriction, which can eat up all the
-            // memory for large files. We should maybe consider changing this...
-            // if (string_table.size() < 256) {
-            string_table += pc;
-            // }
-            p = {c};
-        }
-        // string_table.print();
-    }
-    // print_bits(p);
-    // std::cout << " -> ";
-    // send out the "END" code
-    for (auto bit : serialise_for(string_table.size(), string_table.size() + 1)) {
-        // std::cout << bit;
-        *result = bit;
-        ++result;
-    }
-    // std::cout << " ";
-    // restore all previously-dropped symbol codes
-    string_table.restore_dropped_codes();
-    // write out last remaining symbol left on output
-    for (auto bit : serialise_for(*string_table[p], string_table.size())) {
-        // std::cout << bit;
-        *result = bit;
-        ++result;
+        }
     }
-    // std::cout << std::endl;
-    return result;
+    return candidates;
+}
+
+// a block compressed with one of the candidate settings, and how long that took
+struct TrialBlock {
+    std::size_t size; // how many bytes it decompresses to
+    std::size_t candidate;
+    std::string codes;
+    std::chrono::steady_clock::duration time;
+};
+
+// compresses the input file in independent blocks across the given number of threads,
+// writing them out in order followed by their index. returns false if the file couldn't all be read.
+// blocks are read straight out of the input file's mapping if there is one.
+// if the header is ADAPTIVE, every block is compressed with each of the candidate settings, each on whichever thread is
+// free, and the smallest result is kept, or with some slack, the quickest within that many percent of the smallest
+// (which isn't necessarily the same from one run to the next). each block then starts with the settings it was kept with
+bool compress_blocks(const StreamHeader& header, const std::vector<StreamHeader>& candidates, double slack,
+    const char* input_path, const MappedInputFile* mapped, std::ostream& output, std::size_t threads) {
+    std::error_code error;
+    // blocks are read from wherever they start, so it has to be a file with a size
+    std::uint64_t input_size = mapped ? mapped->size() : std::filesystem::file_size(input_path, error);
+    if (error) { return false; }
+    // set if the file turns out shorter than it was, part-way through
+    std::atomic<bool> short_read = false;
+    std::size_t count = (input_size + header.block_size - 1) / header.block_size;
+    bool adaptive = header.symbol_bits == StreamHeader::ADAPTIVE;
+    std::size_t trials = adaptive ? candidates.size() : 1;
+    BlockIndex index;
+    index.end = StreamHeader::SIZE;
+    // every trial of the block being written out so far
+    std::vector<TrialBlock> block_trials;
+    parallel_ordered(count * trials, threads, std::max(threads * 2, trials),
+        [&](std::size_t trial) {
+            std::size_t i = trial / trials;
+            std::uint64_t offset = i * header.block_size;
+            std::size_t size = std::min<std::uint64_t>(header.block_size, input_size - offset);
+            std::string buffer;
+            std::string_view block;
+            if (mapped) {
+                block = std::string_view(mapped->begin() + offset, size);
+            } else {
+                // each block is read by the thread that compresses it
+                LZW_BIT_STAT_TIMER(io_time);
+                std::ifstream input(input_path, std::ifstream::binary);
+                input.seekg(offset);
+                buffer.resize(size);
+                if (not input.read(buffer.data(), size)) { short_read = true; }
+                block = buffer;
+            }
+            std::size_t candidate = trial % trials;
+            auto start = std::chrono::steady_clock::now();
+            std::string codes = run_block('c', adaptive ? candidates[candidate] : header, block);
+            return TrialBlock{size, candidate, std::move(codes), std::chrono::steady_clock::now() - start};
+        },
+        [&](std::size_t, TrialBlock block) {
+            block_trials.push_back(std::move(block));
+            if (block_trials.size() < trials) { return; }
+            auto smallest = std::min_element(block_trials.begin(), block_trials.end(),
+                [](const TrialBlock& a, const TrialBlock& b) { return a.codes.size() < b.codes.size(); });
+            auto kept = smallest;
+            for (auto it = block_trials.begin(); it != block_trials.end(); ++it) {
+                if (it->codes.size() <= smallest->codes.size() * (1 + slack / 100) and it->time < kept->time) { kept = it; }
+            }
+            index.offsets.push_back(index.end);
+            index.sizes.push_back(kept->size);
+            LZW_BIT_STAT_TIMER(io_time);
+            if (adaptive) {
+                candidates[kept->candidate].write_settings(std::ostreambuf_iterator<char>(output));
+                index.end += StreamHeader::SETTINGS_SIZE;
+            }
+            output.write(kept->codes.data(), kept->codes.size());
+            index.end += kept->codes.size();
+            block_trials.clear();
+        }
+    );
+    index.write(std::ostreambuf_iterator<char>(output));
+    return not short_read;
 }
 
-// helper function for lzw_bit_decompress()
-// reads one symbol from the input stream
-// this is useful because symbols are variable-width --it depends on current table size
-template <class InputIterator>
-std::vector<bool> read_next_symbol(InputIterator& first, InputIterator& last, std::size_t code_table_size) {
-    // need to know how many bits currently needed to store codes in dictionary
-    std::size_t bits_needed = std::ceil(std::log2(code_table_size));
-    std::vector<bool> codeword_bits(bits_needed);
-    // attempt to read this many bits into vector, bailing if we exhaust the source
-    for (std::size_t i = 0; i < codeword_bits.size(); i++) {
-        if (first == last) {
-            // if we didn't get enough bits, this is padding data and must be ignored
-            return {};
-        }
-        codeword_bits[i] = *first;
-        ++first;
-    }
-    // print_bits(codeword_bits);
-    // now we have a codeword as a sequence of bits, convert to codeword and look up
-    return codeword_bits;
+// decompresses the uncompressed byte range [first, last) of a block-compressed file across the
+// given number of threads, only decoding those blocks that overlap it
+bool decompress_blocks(const StreamHeader& header, const char* input_path, std::ostream& output, std::size_t threads, std::uint64_t first, std::uint64_t last) {
+    std::ifstream input(input_path, std::ifstream::binary);
+    auto index = BlockIndex::read(input);
+    if (not index) { return false; }
+    // find the blocks that overlap the range and where each of them starts in the uncompressed data
+    std::vector<std::size_t> blocks;
+    std::vector<std::uint64_t> starts;
+    std::uint64_t start = 0;
+    for (std::size_t i = 0; i < index->sizes.size(); ++i) {
+        if (start < last and start + index->sizes[i] > first) {
+            blocks.push_back(i);
+            starts.push_back(start);
+        }
+        start += index->sizes[i];
+    }
+    bool valid = true;
+    parallel_ordered(blocks.size(), threads, threads * 2,
+        [&](std::size_t j) {
+            auto [begin, end] = index->compressed_range(blocks[j]);
+            std::string block(end - begin, '\0');
+            {
+                LZW_BIT_STAT_TIMER(io_time);
+                std::ifstream input(input_path, std::ifstream::binary);
+                input.seekg(begin);
+                input.read(block.data(), block.size());
+            }
+            if (header.symbol_bits != StreamHeader::ADAPTIVE) { return run_block('d', header, block); }
+            // the settings the block was compressed with come first
+            StreamHeader settings = header;
+            std::string_view codes = block;
+            auto cursor = codes.begin();
+            if (not settings.read_settings(cursor, codes.end()) or settings.check(settings.preset) != DecodeError::NONE) {
+                return std::string();
+            }
+            return run_block('d', settings, codes.substr(StreamHeader::SETTINGS_SIZE));
+        },
+        [&](std::size_t j, std::string block) {
+            if (block.size() != index->sizes[blocks[j]]) { valid = false; }
+            // only write out the part of the block that's within the range
+            std::uint64_t from = std::max(first, starts[j]) - starts[j];
+            std::uint64_t to = std::min<std::uint64_t>(last - starts[j], block.size());
+            LZW_BIT_STAT_TIMER(io_time);
+            if (from < to) { output.write(block.data() + from, to - from); }
+        }
+    );
+    return valid;
 }
 
-template <class OutputIterator>
-void output_string(std::vector<bool> string, OutputIterator& result) {
-    for (auto bit : string) {
-        // std::cout << bit;
-        *result = bit;
-        ++result;
+// the directory at the end of an archive of many files, each compressed as its own stream of codes, saying where each one
+// is and how to get it back. consecutive members can share a code table, each carrying on from where the one before left it,
+// so only the first member of such a chain can be decompressed on its own, and the others need the ones before them
+struct ArchiveDirectory {
+    struct Member {
+        std::string name; // where it's extracted to, relative to the destination, with / between directories
+        std::uint64_t offset = 0; // where its codes start in the archive
+        std::uint64_t size = 0; // how many bytes it decompresses to
+        std::uint64_t chain = 0; // the member its chain starts with, which may be itself
+    };
+    std::vector<Member> members;
+    std::uint64_t end = 0; // where the last member's codes end, which is also where the directory starts
+
+    // an archive starts with this, then the header for the settings every member is compressed with
+    static constexpr char MAGIC[4] = {'L', 'Z', 'W', 'a'};
+    // where the first member's codes start
+    static constexpr std::size_t START = sizeof(MAGIC) + StreamHeader::SIZE;
+    static constexpr std::size_t TRAILER_SIZE = 16;
+
+    template <class OutputIterator>
+    static OutputIterator write_header(OutputIterator result, const StreamHeader& header) {
+        result = std::copy(std::begin(MAGIC), std::end(MAGIC), result);
+        return header.write(result);
     }
+    template <class InputIterator>
+    static std::optional<StreamHeader> read_header(InputIterator& first, InputIterator last) {
+        for (char c : MAGIC) {
+            if (first == last or *first != c) { return std::nullopt; }
+            ++first;
+        }
+        auto header = StreamHeader::read(first, last);
+        if (not header or header->block_size != 0) { return std::nullopt; }
+        return header;
+    }
+    template <class OutputIterator>
+    OutputIterator write(OutputIterator result) const {
+        for (const Member& member : members) {
+            result = write_big_endian(result, member.offset, 8);
+            result = write_big_endian(result, member.size, 8);
+            result = write_big_endian(result, member.chain, 8);
+            result = write_big_endian(result, member.name.size(), 2);
+            result = std::copy(member.name.begin(), member.name.end(), result);
+        }
+        result = write_big_endian(result, end, 8);
+        return write_big_endian(result, members.size(), 8);
+    }
+    // reads the directory from the end of an archive, or nullopt if it's not valid
+    static std::optional<ArchiveDirectory> read(std::istream& input) {
+        input.seekg(0, std::ios::end);
+        std::uint64_t file_size = input.tellg();
+        if (file_size < START + TRAILER_SIZE) { return std::nullopt; }
+        char trailer[TRAILER_SIZE];
+        input.seekg(file_size - TRAILER_SIZE);
+        if (not input.read(trailer, TRAILER_SIZE)) { return std::nullopt; }
+        const char* cursor = trailer;
+        const char* trailer_end = trailer + TRAILER_SIZE;
+        ArchiveDirectory directory;
+        directory.end = *read_big_endian(cursor, trailer_end, 8);
+        std::uint64_t count = *read_big_endian(cursor, trailer_end, 8);
+        if (directory.end < START or directory.end > file_size - TRAILER_SIZE) { return std::nullopt; }
+        std::string entries(file_size - TRAILER_SIZE - directory.end, '\0');
+        input.seekg(directory.end);
+        if (not input.read(entries.data(), entries.size())) { return std::nullopt; }
+        cursor = entries.data();
+        const char* entries_end = entries.data() + entries.size();
+        for (std::uint64_t i = 0; i < count; ++i) {
+            Member member;
+            auto offset = read_big_endian(cursor, entries_end, 8);
+            auto size = read_big_endian(cursor, entries_end, 8);
+            auto chain = read_big_endian(cursor, entries_end, 8);
+            auto name_size = read_big_endian(cursor, entries_end, 2);
+            if (not name_size or (std::size_t)(entries_end - cursor) < *name_size) { return std::nullopt; }
+            member.name.assign(cursor, *name_size);
+            cursor += *name_size;
+            member.offset = *offset;
+            member.size = *size;
+            member.chain = *chain;
+            // members are in order, and each chain is a run of them that starts with its own first member
+            if (member.offset < (i == 0 ? START : directory.members.back().offset) or member.offset > directory.end) { return std::nullopt; }
+            if (member.chain != i and (i == 0 or member.chain != directory.members.back().chain)) { return std::nullopt; }
+            if (not safe_name(member.name)) { return std::nullopt; }
+            directory.members.push_back(std::move(member));
+        }
+        if (cursor != entries_end) { return std::nullopt; }
+        return directory;
+    }
+    // the range of compressed bytes taken up by the given member
+    std::pair<std::uint64_t, std::uint64_t> compressed_range(std::size_t member) const {
+        return {members[member].offset, member + 1 < members.size() ? members[member + 1].offset : end};
+    }
+    // whether a member name stays inside the directory it's extracted to
+    static bool safe_name(std::string_view name) {
+        if (name.empty() or name.front() == '/') { return false; }
+        for (std::size_t start = 0; start <= name.size();) {
+            std::size_t next = std::min(name.find('/', start), name.size());
+            if (name.substr(start, next - start) == "..") { return false; }
+            start = next + 1;
+        }
+        return true;
+    }
+};
+
+// compresses files into an archive, in chains of up to chain_length consecutive members that carry the code table on from
+// one to the next, writing them out in order followed by the directory. each chain is compressed on its own thread.
+// members are (name, path) pairs. returns false if any of them can't be read
+template <std::size_t SYMBOL_BITS>
+bool compress_archive(const StreamHeader& header, const std::vector<std::pair<std::string, std::filesystem::path>>& members, std::size_t chain_length, std::ostream& output, std::size_t threads) {
+    ArchiveDirectory directory;
+    directory.end = ArchiveDirectory::START;
+    bool valid = true;
+    std::size_t chains = (members.size() + chain_length - 1) / chain_length;
+    parallel_ordered(chains, threads, threads * 2,
+        [&](std::size_t chain) {
+            // the size and codes of each member of the chain, or nullopt if any of them couldn't be read
+            std::optional<std::vector<std::pair<std::uint64_t, std::string>>> compressed;
+            compressed.emplace();
+            LzwBitEncoder<SYMBOL_BITS> encoder(header.limit, header.packing, header.elimination, header.preset);
+            for (std::size_t i = chain * chain_length; i < std::min(members.size(), (chain + 1) * chain_length); ++i) {
+                MappedInputFile input(members[i].second.c_str());
+                if (not input.is_open()) { return decltype(compressed)(); }
+                if (i != chain * chain_length) { encoder.restart(); }
+                std::string codes;
+                bit_writer writer(std::back_inserter(codes));
+                for (char c : input) {
+                    encoder.encode_byte((std::uint8_t)c, writer);
+                }
+                encoder.end(writer);
+                writer.flush();
+                compressed->emplace_back(input.size(), std::move(codes));
+            }
+            return compressed;
+        },
+        [&](std::size_t chain, std::optional<std::vector<std::pair<std::uint64_t, std::string>>> compressed) {
+            if (not compressed) {
+                valid = false;
+                return;
+            }
+            for (std::size_t j = 0; j < compressed->size(); ++j) {
+                auto& [size, codes] = (*compressed)[j];
+                directory.members.push_back({members[chain * chain_length + j].first, directory.end, size, chain * chain_length});
+                LZW_BIT_STAT_TIMER(io_time);
+                output.write(codes.data(), codes.size());
+                directory.end += codes.size();
+            }
+        }
+    );
+    directory.write(std::ostreambuf_iterator<char>(output));
+    return valid;
 }
 
-template <class InputIterator, class OutputIterator>
-OutputIterator lzw_bit_decompress(InputIterator first, InputIterator last, OutputIterator result) {
-    CodeTable string_table;
-    // NOTE: +1 is to account for the special "END" symbol, not in table
-    auto w = read_next_symbol(first, last, string_table.size() + 1);
-    if (w.empty()) { return result; } // no more symbols left to decode
-    auto k = deserialise(w);
-    std::vector<bool> entry;
-    // std::cout << " -> ";
-    w = string_table[k];
-    output_string(w, result);
-    // std::cout << std::endl;
-    while (first != last) {
-        // string_table.print();
-        // +1 to table size is because every new symbol read adds another to the table
-        // additional +1 is to account for the special "END" symbol, which is not in table
-        auto next_symbol = read_next_symbol(first, last, string_table.size() + 2);
-        if (next_symbol.empty()) { break; } // no more symbols left to decode
-        k = deserialise(next_symbol);
-        if (k == string_table.size() + 1) { // "END" symbol encountered
-            // std::cout << " ";
-            string_table.restore_dropped_codes();
-            continue;
-        }
-        // std::cout << " -> ";
-        if (auto found = string_table.find(k)) {
-            entry = found->bitstring();
-            output_string(entry, result);
-            auto extra_code = w;
-            extra_code.push_back(entry[0]);
-            string_table += extra_code;
-            string_table.drop_oldest_redundant_code();
-            w = entry;
+// decompresses the wanted members of an archive into the destination directory. every chain with any of them in is decoded
+// on its own thread, from its first member up to the last one wanted. returns false if any of them come out wrong
+template <std::size_t SYMBOL_BITS>
+bool extract_archive(const StreamHeader& header, const char* archive_path, const ArchiveDirectory& directory, const std::vector<bool>& wanted, const std::filesystem::path& destination, std::size_t threads) {
+    // the first member of each chain that's needed, and the last one wanted from it
+    std::vector<std::pair<std::size_t, std::size_t>> chains;
+    for (std::size_t i = 0; i < directory.members.size(); ++i) {
+        if (not wanted[i]) { continue; }
+        std::size_t chain = directory.members[i].chain;
+        if (chains.empty() or chains.back().first != chain) {
+            chains.emplace_back(chain, i);
         } else {
-            entry = w;
-            entry.push_back(w[0]);
-            output_string(entry, result);
-            string_table += entry;
-            string_table.drop_oldest_redundant_code();
-            w = entry;
+            chains.back().second = i;
         }
-        // std::cout << std::endl;
-        // string_table.print();
     }
-    return result;
+    bool valid = true;
+    parallel_ordered(chains.size(), threads, threads * 2,
+        [&](std::size_t j) {
+            auto [first, last] = chains[j];
+            std::string codes(directory.compressed_range(last).second - directory.members[first].offset, '\0');
+            {
+                LZW_BIT_STAT_TIMER(io_time);
+                std::ifstream input(archive_path, std::ifstream::binary);
+                input.seekg(directory.members[first].offset);
+                input.read(codes.data(), codes.size());
+            }
+            // the wanted members' indices and contents
+            std::vector<std::pair<std::size_t, std::string>> extracted;
+            LzwBitDecoder<SYMBOL_BITS> decoder(header.limit, header.packing, header.elimination, header.preset);
+            for (std::size_t i = first; i <= last; ++i) {
+                if (i != first) { decoder.restart(); }
+                auto [begin, end] = directory.compressed_range(i);
+                const char* member_codes = codes.data() + (begin - directory.members[first].offset);
+                std::string contents;
+                bit_reader reader(member_codes, member_codes + (end - begin));
+                bit_writer writer(std::back_inserter(contents));
+                while (auto k = decoder.read_code(reader)) {
+                    if (not decoder.decode(*k, writer)) { break; }
+                }
+                writer.flush();
+                if (wanted[i]) { extracted.emplace_back(i, std::move(contents)); }
+            }
+            return extracted;
+        },
+        [&](std::size_t, std::vector<std::pair<std::size_t, std::string>> extracted) {
+            for (auto& [i, contents] : extracted) {
+                if (contents.size() != directory.members[i].size) { valid = false; }
+                std::filesystem::path path = destination / directory.members[i].name;
+                LZW_BIT_STAT_TIMER(io_time);
+                std::error_code error;
+                std::filesystem::create_directories(path.parent_path(), error);
+                std::ofstream output(path, std::ofstream::binary);
+                output.write(contents.data(), contents.size());
+                if (not output) { valid = false; }
+            }
+        }
+    );
+    return valid;
 }
 
-///////////////////////////////////////////////////////////////////////////////
+#include <exception>
 
-#include <random>
+#include "spsc_ring.hpp"
 
+// the input and output of pipe_stream(), read and written a chunk at a time.
+// normally this is all done on the calling thread, in between compressing or decompressing. when pipelined,
+// a reader thread and a writer thread do it instead, handing full buffers to and from the calling thread
+// through lock-free rings and getting them back through more rings once they're empty, so that waiting
+// on I/O overlaps with compressing or decompressing, and no buffers are allocated after the start
+class StreamIo {
+public:
+    static constexpr std::size_t CHUNK_SIZE = 1 << 16;
 
-template <class Iterable>
-void print(Iterable bits) {
-    for (auto bit : bits) {
-        std::cout << bit << " ";
+    StreamIo(int input_fd, int output_fd, bool pipelined) : _input_fd(input_fd), _output_fd(output_fd), _pipelined(pipelined) {
+        if (not _pipelined) {
+            _input.data.resize(CHUNK_SIZE);
+            _output.data.resize(CHUNK_SIZE);
+            return;
+        }
+        // enough buffers that each stage can be working on one while another waits in between every two
+        for (std::size_t i = 0; i < BUFFERS; ++i) {
+            _empty_input.push({std::vector<std::byte>(CHUNK_SIZE)});
+            _empty_output.push({std::vector<std::byte>(CHUNK_SIZE)});
+        }
+        _reader = std::thread([this]() { _read_all(); });
+        _writer = std::thread([this]() { _write_all(); });
     }
-    std::cout << std::endl;
-}
+    // stops the reader, which is left waiting for a buffer if the input wasn't all needed,
+    // and the writer, if finish() wasn't called
+    ~StreamIo() {
+        if (not _pipelined) { return; }
+        _stop_reader();
+        if (_writer.joinable()) {
+            _filled_output.push({{}, 0, true});
+            _writer.join();
+        }
+    }
+    // non-copyable, as the threads refer to it
+    StreamIo(const StreamIo&) = delete;
+    StreamIo& operator=(const StreamIo&) = delete;
 
-#include <fstream>
+    // the next chunk of input, valid until the next call, or an empty span once it has all been read
+    std::span<const std::byte> read_some() {
+        if (not _pipelined) {
+            _input.size = _read(_input);
+            _read_total += _input.size;
+            return {_input.data.data(), _input.size};
+        }
+        if (_input_ended) { return {}; }
+        if (not _input.data.empty()) { _empty_input.push(std::move(_input)); }
+        _input = _filled_input.pop();
+        _input_ended = _input.size == 0;
+        return {_input.data.data(), _input.size};
+    }
+    // somewhere to put output, which produced() then says how much of was used
+    std::span<std::byte> output_space() {
+        if (_pipelined and _output.data.empty()) { _output = _empty_output.pop(); }
+        return std::span<std::byte>(_output.data).subspan(_output.size);
+    }
+    void produced(std::size_t count) {
+        _output.size += count;
+        if (not _pipelined) {
+            flush();
+        } else if (_output.size == _output.data.size()) {
+            flush();
+        }
+    }
+    // sends everything produced so far on its way
+    void flush() {
+        if (_output.size == 0) { return; }
+        if (not _pipelined) {
+            _write(_output);
+            _written_total += _output.size;
+            _output.size = 0;
+            return;
+        }
+        _filled_output.push(std::move(_output));
+        _output = {};
+    }
+    // waits for all the output to be written, returning how many bytes were read and written,
+    // and throwing anything that went wrong writing it
+    std::pair<std::uint64_t, std::uint64_t> finish() {
+        flush();
+        if (_pipelined) {
+            _stop_reader();
+            _filled_output.push({{}, 0, true});
+            _writer.join();
+            if (_error) { std::rethrow_exception(_error); }
+        }
+        return {_read_total, _written_total};
+    }
 
-#include "bit_iterator.hpp"
+private:
+    struct Buffer {
+        std::vector<std::byte> data;
+        std::size_t size = 0;
+        bool last = false; // only for telling the writer there's no more to come
+    };
+    static constexpr std::size_t BUFFERS = 4;
 
-int main(int, char* argv[]) {
-    char mode = argv[1][0];
-    auto input_file = std::ifstream(argv[2], std::ifstream::binary);
-    auto output_file = std::ofstream(argv[3], std::ofstream::binary);
-    auto file_reader = std::istreambuf_iterator<char>(input_file);
-    auto file_writer = std::ostreambuf_iterator<char>(output_file);
+    // reads whatever is available, up to a buffer's worth, returning 0 at the end of the input
+    std::size_t _read(Buffer& buffer) {
+        LZW_BIT_STAT_TIMER(io_time);
+        ssize_t count;
+        do {
+            count = ::read(_input_fd, buffer.data.data(), buffer.data.size());
+        } while (count == -1 and errno == EINTR);
+        return count <= 0 ? 0 : count;
+    }
+    void _write(const Buffer& buffer) {
+        LZW_BIT_STAT_TIMER(io_time);
+        for (std::size_t written = 0; written < buffer.size;) {
+            ssize_t result = ::write(_output_fd, buffer.data.data() + written, buffer.size - written);
+            if (result == -1 and errno == EINTR) { continue; }
+            if (result <= 0) { throw std::system_error(errno, std::generic_category(), "couldn't write output"); }
+            written += result;
+        }
+    }
+    // the reader might be waiting for a buffer to read into, so it's given one to wake it up
+    void _stop_reader() {
+        if (not _reader.joinable()) { return; }
+        _stopping = true;
+        _empty_input.push({});
+        _reader.join();
+    }
+    // the reader thread, which passes on an empty buffer at the end of the input
+    void _read_all() {
+        while (true) {
+            Buffer buffer = _empty_input.pop();
+            if (_stopping) { return; }
+            buffer.size = _read(buffer);
+            _read_total += buffer.size;
+            bool ended = buffer.size == 0;
+            _filled_input.push(std::move(buffer));
+            if (ended) { return; }
+        }
+    }
+    // the writer thread, which keeps taking buffers after an error so the calling thread is never left waiting
+    void _write_all() {
+        while (true) {
+            Buffer buffer = _filled_output.pop();
+            if (buffer.last) { return; }
+            if (not _error) {
+                try {
+                    _write(buffer);
+                    _written_total += buffer.size;
+                } catch (...) {
+                    _error = std::current_exception();
+                }
+            }
+            buffer.size = 0;
+            _empty_output.push(std::move(buffer));
+        }
+    }
+
+    int _input_fd;
+    int _output_fd;
+    bool _pipelined;
+    // the buffers the calling thread is reading from and writing to
+    Buffer _input;
+    Buffer _output;
+    bool _input_ended = false;
+    // totals are only touched by whichever thread does the reading or writing, until it's joined
+    std::uint64_t _read_total = 0;
+    std::uint64_t _written_total = 0;
+    std::exception_ptr _error;
+    std::atomic<bool> _stopping = false;
+    // the rings can hold every buffer at once, so only popping ever has to wait
+    SpscRing<Buffer> _filled_input{BUFFERS * 2};
+    SpscRing<Buffer> _empty_input{BUFFERS * 2};
+    SpscRing<Buffer> _filled_output{BUFFERS * 2};
+    SpscRing<Buffer> _empty_output{BUFFERS * 2};
+    std::thread _reader;
+    std::thread _writer;
+};
+
+// moves data between file descriptors through the push-style encoder or decoder a chunk at a time,
+// so that it works on pipes and only ever needs a chunk's worth of buffers (a few of each, when pipelined).
+// returns how many bytes were read and written, or nullopt if the input isn't a valid compressed stream (or is cut short)
+std::optional<std::pair<std::uint64_t, std::uint64_t>> pipe_stream(char mode, StreamHeader header, int input_fd, int output_fd, bool pipelined = false) {
+    StreamIo io(input_fd, output_fd, pipelined);
+    std::span<const std::byte> chunk;
+    // the start of the input, when the header has to be picked out of it
+    std::vector<std::byte> start;
     if (mode == 'c') {
-        // std::cout << std::endl << std::endl << std::endl;
-        lzw_bit_compress(
-            char_bit_input_iterator<std::istreambuf_iterator, char>(file_reader),
-            char_bit_input_iterator<std::istreambuf_iterator, char>(),
-            char_bit_output_iterator<std::ostreambuf_iterator, char>(file_writer)
-        ); // any unwritten partial-byte bitstreams get written here as the output iterator goes out of scope
-    } else if (mode == 'd') {
-        lzw_bit_decompress(
-            char_bit_input_iterator<std::istreambuf_iterator, char>(file_reader),
-            char_bit_input_iterator<std::istreambuf_iterator, char>(),
-            char_bit_output_iterator<std::ostreambuf_iterator, char>(file_writer)
-        ); // any unwritten partial-byte bitstreams get written here as the output iterator goes out of scope
+        header.write((char*)io.output_space().data());
+        io.produced(StreamHeader::SIZE);
     } else {
-        std::cerr << "Usage: " << argv[0] << " [c|d] <input file> <output file>" << std::endl;
+        // the header might arrive in pieces, and whatever comes after it is the start of the codes
+        while (start.size() < StreamHeader::SIZE and not (chunk = io.read_some()).empty()) {
+            start.insert(start.end(), chunk.begin(), chunk.end());
+        }
+        const char* first = (const char*)start.data();
+        auto stored = StreamHeader::read(first, first + start.size());
+        if (not stored or stored->block_size != 0 or stored->check(header.preset) != DecodeError::NONE) { return std::nullopt; }
+        stored->preset = header.preset;
+        header = *stored;
+        chunk = std::span<const std::byte>(start).subspan(StreamHeader::SIZE);
+    }
+    DecodeError error = DecodeError::NONE;
+    with_symbol_bits(header.symbol_bits, [&](auto bits) {
+        if (mode == 'c') {
+            LzwBitEncoder<bits> encoder(header.limit, header.packing, header.elimination, header.preset);
+            while (not (chunk = io.read_some()).empty()) {
+                while (not chunk.empty()) {
+                    auto progress = encoder.write(chunk, io.output_space());
+                    io.produced(progress.produced);
+                    chunk = chunk.subspan(progress.consumed);
+                }
+                // send out everything we can so that whoever is reading isn't kept waiting
+                do {
+                    io.produced(encoder.flush(io.output_space()));
+                } while (encoder.pending());
+                io.flush();
+            }
+            do {
+                io.produced(encoder.finish(io.output_space()));
+            } while (encoder.pending());
+        } else {
+            LzwBitDecoder<bits> decoder(header.limit, header.packing, header.elimination, header.preset);
+            do {
+                while (not chunk.empty() and not decoder.done()) {
+                    auto progress = decoder.write(chunk, io.output_space());
+                    io.produced(progress.produced);
+                    chunk = chunk.subspan(progress.consumed);
+                }
+            } while (not decoder.done() and not (chunk = io.read_some()).empty());
+            // codes already read in can still be held back, if output was full when they arrived
+            while (not decoder.done()) {
+                auto progress = decoder.write({}, io.output_space());
+                if (progress.produced == 0) { break; }
+                io.produced(progress.produced);
+            }
+            do {
+                io.produced(decoder.finish(io.output_space()));
+            } while (decoder.pending());
+            error = decoder.error();
+        }
+    });
+    auto sizes = io.finish();
+    if (error != DecodeError::NONE) { return std::nullopt; }
+    return sizes;
+}
+
+#include <chrono>
+#include <iomanip>
+
+#ifdef LZW_BIT_STATS
+// prints everything counted so far as JSON, to standard error as standard output might be where the data's going
+void print_statistics(std::chrono::steady_clock::time_point start) {
+    std::cerr << total_statistics().json(std::chrono::steady_clock::now() - start) << std::endl;
+}
+#endif
+
+// checks that a compressed file or archive can be decompressed with the preset dictionary given (or without one),
+// saying why not if it can't
+bool check_header(const StreamHeader& stored, const PresetDictionary* preset, const char* path) {
+    switch (stored.check(preset)) {
+    case DecodeError::NONE:
+        return true;
+    case DecodeError::WRONG_DICTIONARY:
+        if (stored.dictionary_id == 0) {
+            std::cerr << path << " was compressed without a preset dictionary" << std::endl;
+        } else {
+            std::cerr << path << " needs preset dictionary " << std::hex << std::setw(8) << std::setfill('0') << stored.dictionary_id << std::endl;
+        }
+        return false;
+    default:
+        std::cerr << "Not a valid compressed file: " << path << std::endl;
+        return false;
+    }
+}
+
+// the name a file is archived under: its path without anything that would take it outside
+// the directory it's extracted to, or nullopt if that leaves nothing or is too long
+std::optional<std::string> archive_name(const std::filesystem::path& path) {
+    std::string name;
+    for (const auto& part : path.lexically_normal().relative_path()) {
+        if (part == "." or part == ".." or part.empty()) { continue; }
+        if (not name.empty()) { name += '/'; }
+        name += part.string();
+    }
+    if (name.empty() or name.size() > std::numeric_limits<std::uint16_t>::max()) { return std::nullopt; }
+    return name;
+}
+
+// creates (a), extracts from (x) or lists (l) an archive, returning the exit status.
+// the header has the settings to compress with, or the preset dictionary to extract with
+int run_archive(char mode, StreamHeader header, const std::vector<char*>& positional, std::size_t chain_length, std::size_t threads) {
+    const char* archive_path = positional[1];
+    if (mode == 'a') {
+        std::vector<std::pair<std::string, std::filesystem::path>> members;
+        std::uint64_t input_size = 0;
+        for (std::size_t i = 2; i < positional.size(); ++i) {
+            std::filesystem::path input = positional[i];
+            std::vector<std::filesystem::path> files;
+            std::error_code error;
+            if (std::filesystem::is_directory(input, error)) {
+                // sorted, so that files next to each other, which are most likely to be alike, share chains
+                for (const auto& entry : std::filesystem::recursive_directory_iterator(input, error)) {
+                    if (entry.is_regular_file()) { files.push_back(entry.path()); }
+                }
+                std::sort(files.begin(), files.end());
+            } else {
+                files.push_back(input);
+            }
+            for (const auto& file : files) {
+                auto name = archive_name(file);
+                if (not name) {
+                    std::cerr << "Can't archive " << file << std::endl;
+                    return 1;
+                }
+                input_size += std::filesystem::file_size(file, error);
+                members.emplace_back(*name, file);
+            }
+        }
+        std::ofstream output(archive_path, std::ofstream::binary);
+        ArchiveDirectory::write_header(std::ostreambuf_iterator<char>(output), header);
+        bool compressed = true;
+        with_symbol_bits(header.symbol_bits, [&](auto bits) {
+            compressed = compress_archive<bits>(header, members, chain_length, output, threads);
+        });
+        output.close();
+        if (not compressed) {
+            std::cerr << "Couldn't read all of the files to archive" << std::endl;
+            return 1;
+        }
+        std::size_t output_size = std::filesystem::file_size(archive_path);
+        std::cout << members.size() << " files, " << input_size << " bytes -> " << output_size << " bytes ("
+                  << std::ceil((double)output_size / std::max<std::uint64_t>(input_size, 1) * 100) << "%)" << std::endl;
+        return 0;
+    }
+    std::ifstream input(archive_path, std::ifstream::binary);
+    auto reader = std::istreambuf_iterator<char>(input);
+    auto stored = ArchiveDirectory::read_header(reader, std::istreambuf_iterator<char>());
+    auto directory = stored ? ArchiveDirectory::read(input) : std::nullopt;
+    if (not directory) {
+        std::cerr << "Not a valid archive: " << archive_path << std::endl;
+        return 1;
+    }
+    if (mode == 'l') {
+        std::cout << "size\tcompressed\tchain\tname" << std::endl;
+        for (std::size_t i = 0; i < directory->members.size(); ++i) {
+            auto [begin, end] = directory->compressed_range(i);
+            const auto& member = directory->members[i];
+            std::cout << member.size << "\t" << end - begin << "\t" << member.chain << "\t" << member.name << std::endl;
+        }
+        return 0;
+    }
+    if (not check_header(*stored, header.preset, archive_path)) { return 1; }
+    stored->preset = header.preset;
+    // with no members named, everything is extracted. a name can be a directory, meaning everything in it
+    std::vector<bool> wanted(directory->members.size(), positional.size() == 3);
+    for (std::size_t i = 3; i < positional.size(); ++i) {
+        std::string name = archive_name(positional[i]).value_or("");
+        bool found = false;
+        for (std::size_t j = 0; j < directory->members.size(); ++j) {
+            const std::string& member = directory->members[j].name;
+            if (member == name or (member.size() > name.size() and member.starts_with(name) and member[name.size()] == '/')) {
+                wanted[j] = found = true;
+            }
+        }
+        if (not found) {
+            std::cerr << "No such member: " << positional[i] << std::endl;
+            return 1;
+        }
+    }
+    bool extracted = true;
+    with_symbol_bits(stored->symbol_bits, [&](auto bits) {
+        extracted = extract_archive<bits>(*stored, archive_path, *directory, wanted, positional[2], threads);
+    });
+    if (not extracted) {
+        std::cerr << "Couldn't extract everything from " << archive_path << std::endl;
+        return 1;
+    }
+    std::cout << std::count(wanted.begin(), wanted.end(), true) << " files extracted" << std::endl;
+    return 0;
+}
+
+#include <charconv>
+#include <cstring>
+
+// parses the whole of an argument as a number, returning false (and leaving value alone) if it isn't one
+template <class Number>
+bool parse_number(const char* text, Number& value) {
+    const char* last = text + std::strlen(text);
+    auto [end, error] = std::from_chars(text, last, value);
+    return error == std::errc() and end == last;
+}
+
+template <class Number>
+bool parse_number(const char* text, std::optional<Number>& value) {
+    Number parsed;
+    if (not parse_number(text, parsed)) { return false; }
+    value = parsed;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    // positional arguments are the mode, input file and output file, in that order
+    std::vector<char*> positional;
+    StreamHeader header;
+    std::optional<std::size_t> symbol_bits;
+    std::optional<DictionaryPolicy> policy;
+    CodewordPacking packing = CodewordPacking::BINARY;
+    std::optional<RedundantCodeElimination> elimination;
+    std::size_t max_entries = 0;
+    std::size_t max_bytes = 0;
+    std::size_t block_size = 0;
+    std::size_t chain_length = 1;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::optional<double> slack;
+    std::optional<std::uint64_t> range_offset;
+    std::optional<std::uint64_t> range_length;
+    const char* dictionary_path = nullptr;
+    bool mapped = false;
+    bool pipelined = false;
+    bool stats = false;
+    bool valid = true;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-w" and i + 1 < argc) {
+            if (not parse_number(argv[++i], symbol_bits)) { valid = false; }
+        } else if (arg == "-p" and i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "freeze") {
+                policy = DictionaryPolicy::FREEZE;
+            } else if (name == "reset") {
+                policy = DictionaryPolicy::RESET;
+            } else if (name == "prune") {
+                policy = DictionaryPolicy::PRUNE;
+            } else {
+                valid = false;
+            }
+        } else if (arg == "-k" and i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "binary") {
+                packing = CodewordPacking::BINARY;
+            } else if (name == "phase-in") {
+                packing = CodewordPacking::PHASE_IN;
+            } else if (name == "dense") {
+                packing = CodewordPacking::DENSE;
+            } else {
+                valid = false;
+            }
+        } else if (arg == "-r" and i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "immediate") {
+                elimination = RedundantCodeElimination::IMMEDIATE;
+            } else if (name == "batched") {
+                elimination = RedundantCodeElimination::BATCHED;
+            } else if (name == "none") {
+                elimination = RedundantCodeElimination::NONE;
+            } else {
+                valid = false;
+            }
+        } else if (arg == "-m" and i + 1 < argc) {
+            if (not parse_number(argv[++i], max_entries)) { valid = false; }
+        } else if (arg == "-b" and i + 1 < argc) {
+            if (not parse_number(argv[++i], max_bytes)) { valid = false; }
+        } else if (arg == "-B" and i + 1 < argc) {
+            if (not parse_number(argv[++i], block_size)) { valid = false; }
+        } else if (arg == "-A" and i + 1 < argc) {
+            if (not parse_number(argv[++i], slack)) { valid = false; }
+        } else if (arg == "-g" and i + 1 < argc) {
+            if (not parse_number(argv[++i], chain_length)) { valid = false; }
+        } else if (arg == "-j" and i + 1 < argc) {
+            if (not parse_number(argv[++i], threads)) { valid = false; }
+            threads = std::max<std::size_t>(1, threads);
+        } else if (arg == "-o" and i + 1 < argc) {
+            if (not parse_number(argv[++i], range_offset)) { valid = false; }
+        } else if (arg == "-n" and i + 1 < argc) {
+            if (not parse_number(argv[++i], range_length)) { valid = false; }
+        } else if (arg == "-D" and i + 1 < argc) {
+            dictionary_path = argv[++i];
+        } else if (arg == "-M") {
+            mapped = true;
+        } else if (arg == "-P") {
+            pipelined = true;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else {
+            positional.push_back(argv[i]);
+        }
+    }
+    char mode = positional.empty() ? '\0' : positional[0][0];
+    // archives take any number of members, everything else an input and an output
+    bool arguments_valid = mode == 'l' ? positional.size() == 2 : mode == 'a' or mode == 'x' ? positional.size() >= 3 : positional.size() == 3;
+    if (not valid or not arguments_valid or std::string_view("cdtaxl").find(mode) == std::string_view::npos or chain_length == 0
+        or (symbol_bits and *symbol_bits != 1 and *symbol_bits != 2 and *symbol_bits != 4 and *symbol_bits != 8)) {
+        std::cerr << "Usage: " << argv[0] << " c [-w 1|2|4|8] [-p freeze|reset|prune] [-k binary|phase-in|dense] [-r immediate|batched|none] [-m <entries> | -b <bytes>] [-B <block size> [-A <slack>]] [-j <threads>] [-D <dictionary file>] [-M | -P] [--stats] <input file> <output file>" << std::endl;
+        std::cerr << "       " << argv[0] << " d [-j <threads>] [-o <offset>] [-n <length>] [-D <dictionary file>] [-M | -P] [--stats] <input file> <output file>" << std::endl;
+        std::cerr << "       " << argv[0] << " t [-w 1|2|4|8] [-m <entries> | -b <bytes>] <sample file> <dictionary file>" << std::endl;
+        std::cerr << "       " << argv[0] << " a [-w 1|2|4|8] [-p freeze|reset|prune] [-k binary|phase-in|dense] [-r immediate|batched|none] [-m <entries> | -b <bytes>] [-g <members>] [-j <threads>] [-D <dictionary file>] [--stats] <archive file> <input file or directory>..." << std::endl;
+        std::cerr << "       " << argv[0] << " x [-j <threads>] [-D <dictionary file>] [--stats] <archive file> <output directory> [<member>...]" << std::endl;
+        std::cerr << "       " << argv[0] << " l <archive file>" << std::endl;
+        std::cerr << "  -w  bits per symbol (default 1)" << std::endl;
+        std::cerr << "  -p  what to do when the code table is full (default freeze, if a limit is given)" << std::endl;
+        std::cerr << "  -k  how codewords are packed into bits (default binary)" << std::endl;
+        std::cerr << "  -r  when to drop redundant codes from the table (default immediate)" << std::endl;
+        std::cerr << "  -m  limit the code table to this many entries" << std::endl;
+        std::cerr << "  -b  limit the code table to roughly this many bytes of memory" << std::endl;
+        std::cerr << "  -B  compress in independent blocks of this many bytes, in parallel and with an index" << std::endl;
+        std::cerr << "  -A  try settings per block, keeping the smallest or the quickest within this many percent of it" << std::endl;
+        std::cerr << "  -g  carry the code table on through this many archive members at a time (default 1)" << std::endl;
+        std::cerr << "  -j  how many threads to use for block-compressed files and archives (default one per core)" << std::endl;
+        std::cerr << "  -o  only decompress from this offset in the uncompressed data (block-compressed files only)" << std::endl;
+        std::cerr << "  -n  only decompress this many bytes (block-compressed files only)" << std::endl;
+        std::cerr << "  -D  start from a preset dictionary made by t, which the decompressor must be given too" << std::endl;
+        std::cerr << "  -M  memory-map the input file, and the output file too unless block-compressed" << std::endl;
+        std::cerr << "  -P  read, compress or decompress, and write on three threads at once (not for block-compressed files)" << std::endl;
+        std::cerr << "  --stats  print statistics about the run as JSON (only in builds with LZW_BIT_STATS defined)" << std::endl;
+        std::cerr << "  either file can be - for standard input or output, which are processed a chunk at a time" << std::endl;
+        std::cerr << "  other settings are read from the file by the decompressor" << std::endl;
+        return 1;
+    }
+#ifndef LZW_BIT_STATS
+    if (stats) {
+        std::cerr << "Statistics aren't available, rebuild with LZW_BIT_STATS defined to get them" << std::endl;
+        return 1;
+    }
+#endif
+    [[maybe_unused]] auto start = std::chrono::steady_clock::now();
+    // mapped so that however many code tables start from it, it's only ever read in place
+    std::optional<MappedInputFile> dictionary_file;
+    std::optional<PresetDictionary> preset;
+    if (dictionary_path and mode != 't') {
+        dictionary_file.emplace(dictionary_path);
+        if (dictionary_file->is_open()) { preset = PresetDictionary::read(dictionary_file->begin(), dictionary_file->end()); }
+        if (not preset) {
+            std::cerr << "Not a valid dictionary file: " << dictionary_path << std::endl;
+            return 1;
+        }
+        // the width defaults to the one the dictionary was trained with, and can't be anything else
+        if (symbol_bits.value_or(preset->symbol_bits()) != preset->symbol_bits()) {
+            std::cerr << "Dictionary was trained with -w " << preset->symbol_bits() << std::endl;
+            return 1;
+        }
+        symbol_bits = preset->symbol_bits();
+        header.dictionary_id = preset->id();
+        header.preset = &*preset;
+    }
+    header.symbol_bits = symbol_bits.value_or(1);
+    header.packing = packing;
+    header.elimination = elimination.value_or(RedundantCodeElimination::IMMEDIATE);
+    if (max_bytes != 0) {
+        // pruning leaves dead entries behind in between compactions, which can take up to as much again
+        with_symbol_bits(header.symbol_bits, [&](auto bits) { max_entries = max_bytes / CodeTable<bits>::BYTES_PER_NODE; });
+        if (policy == DictionaryPolicy::PRUNE) { max_entries /= 2; }
+    }
+    if (max_entries != 0 or policy) {
+        // the table can't hold less than the 1-symbol strings it starts with
+        if (max_entries < ((std::size_t)1 << header.symbol_bits) or max_entries > std::numeric_limits<std::uint32_t>::max()) {
+            std::cerr << "Dictionary limit must be between " << (1u << header.symbol_bits) << " and " << std::numeric_limits<std::uint32_t>::max() << " entries" << std::endl;
+            return 1;
+        }
+        header.limit = {policy.value_or(DictionaryPolicy::FREEZE), max_entries};
+        if (not header.leaves_room(header.preset)) {
+            std::cerr << "Dictionary limit must be more than the " << (1u << header.symbol_bits) + preset->size() << " entries the preset dictionary starts with" << std::endl;
+            return 1;
+        }
+    }
+    if (block_size > std::numeric_limits<std::uint32_t>::max()) {
+        std::cerr << "Block size must be no more than " << std::numeric_limits<std::uint32_t>::max() << " bytes" << std::endl;
+        return 1;
+    }
+    header.block_size = block_size;
+    std::vector<StreamHeader> candidates;
+    if (slack and mode == 'c') {
+        if (block_size == 0 or *slack < 0) {
+            std::cerr << "-A needs -B, and a slack of at least 0" << std::endl;
+            return 1;
+        }
+        // whatever settings were given are kept to, and the others are all tried
+        std::vector<std::size_t> widths = {1, 2, 4, 8};
+        if (symbol_bits) { widths = {*symbol_bits}; }
+        std::vector<RedundantCodeElimination> eliminations = {RedundantCodeElimination::IMMEDIATE, RedundantCodeElimination::NONE};
+        if (elimination) { eliminations = {*elimination}; }
+        // a small table that keeps to the most recently matched strings suits data that keeps changing
+        std::vector<DictionaryLimit> limits = {DictionaryLimit(), {DictionaryPolicy::PRUNE, ADAPTIVE_PRUNED_ENTRIES}};
+        if (max_entries != 0 or policy) { limits = {header.limit}; }
+        candidates = adaptive_candidates(header, widths, eliminations, limits);
+        header.symbol_bits = StreamHeader::ADAPTIVE;
+    }
+    if (mode == 'a' or mode == 'x' or mode == 'l') {
+        if (block_size != 0 or mapped or pipelined or range_offset or range_length) {
+            std::cerr << "-B, -M, -P, -o and -n can't be used with archives" << std::endl;
+            return 1;
+        }
+        int status = run_archive(mode, header, positional, chain_length, threads);
+        LZW_BIT_STAT(if (stats and status == 0) { print_statistics(start); });
+        return status;
+    }
+    if (mode == 't') {
+        std::ifstream input_file(positional[1], std::ifstream::binary);
+        std::ofstream output_file(positional[2], std::ofstream::binary);
+        if (not input_file or not output_file) {
+            std::cerr << "Couldn't open " << (input_file ? positional[2] : positional[1]) << std::endl;
+            return 1;
+        }
+        std::uint32_t id = 0;
+        with_symbol_bits(header.symbol_bits, [&](auto bits) {
+            id = train_dictionary<bits>(std::istreambuf_iterator<char>(input_file), std::istreambuf_iterator<char>(), std::ostreambuf_iterator<char>(output_file), header.limit);
+        });
+        output_file.close();
+        std::cout << "dictionary " << std::hex << std::setw(8) << std::setfill('0') << id << std::dec << ": "
+                  << std::filesystem::file_size(positional[2]) << " bytes" << std::endl;
+        return 0;
+    }
+    // pipelining works on the same chunk-at-a-time path as standard input and output, which is just
+    // for single streams, so block-compressed files are decompressed the usual way instead
+    if (pipelined and mode == 'd' and std::string_view(positional[1]) != "-") {
+        std::ifstream input_file(positional[1], std::ifstream::binary);
+        auto file_reader = std::istreambuf_iterator<char>(input_file);
+        auto stored = StreamHeader::read(file_reader, std::istreambuf_iterator<char>());
+        if (stored and stored->block_size != 0) { pipelined = false; }
+    }
+    if (std::string_view(positional[1]) == "-" or std::string_view(positional[2]) == "-" or pipelined) {
+        if (block_size != 0 or mapped or range_offset or range_length) {
+            std::cerr << "-B, -M, -o and -n need files, and can't be used with -P" << std::endl;
+            return 1;
+        }
+        int input_fd = std::string_view(positional[1]) == "-" ? STDIN_FILENO : ::open(positional[1], O_RDONLY);
+        int output_fd = std::string_view(positional[2]) == "-" ? STDOUT_FILENO : ::open(positional[2], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (input_fd == -1 or output_fd == -1) {
+            std::cerr << "Couldn't open " << (input_fd == -1 ? positional[1] : positional[2]) << std::endl;
+            return 1;
+        }
+        auto sizes = pipe_stream(mode, header, input_fd, output_fd, pipelined);
+        if (not sizes) {
+            std::cerr << "Not a valid and complete compressed stream, or not one compressed with the given dictionary: " << positional[1] << std::endl;
+            return 1;
+        }
+        // standard output might be where the data's going, so report on standard error
+        std::cerr << sizes->first << " bytes -> " << sizes->second << " bytes" << std::endl;
+        LZW_BIT_STAT(if (stats) { print_statistics(start); });
+        return 0;
+    }
+    // the input has to be there before any output is written
+    if (not std::ifstream(positional[1], std::ifstream::binary)) {
+        std::cerr << "Couldn't open " << positional[1] << std::endl;
+        return 1;
+    }
+    if (mode == 'd') {
+        std::ifstream input_file(positional[1], std::ifstream::binary);
+        auto file_reader = std::istreambuf_iterator<char>(input_file);
+        if (auto stored = StreamHeader::read(file_reader, std::istreambuf_iterator<char>())) {
+            stored->preset = header.preset;
+            header = *stored;
+        } else {
+            std::cerr << "Not a valid compressed file: " << positional[1] << std::endl;
+            return 1;
+        }
+        if (not check_header(header, header.preset, positional[1])) { return 1; }
+    }
+    if ((range_offset or range_length) and header.block_size == 0) {
+        std::cerr << "Only block-compressed files can be partially decompressed" << std::endl;
+        return 1;
+    }
+    std::optional<MappedInputFile> mapped_input;
+    if (mapped) {
+        mapped_input.emplace(positional[1]);
+        if (not mapped_input->is_open()) {
+            std::cerr << "Couldn't map input file: " << positional[1] << std::endl;
+            return 1;
+        }
+    }
+    bool decoded = true;
+    DecodeError error = DecodeError::NONE;
+    if (header.block_size != 0) {
+        // blocks each pick the instantiation of the engine for their own width, which for adaptive files can vary
+        auto output_file = std::ofstream(positional[2], std::ofstream::binary);
+        if (mode == 'c') {
+            header.write(std::ostreambuf_iterator<char>(output_file));
+            decoded = compress_blocks(header, candidates, slack.value_or(0), positional[1], mapped_input ? &*mapped_input : nullptr, output_file, threads);
+        } else {
+            std::uint64_t first = range_offset.value_or(0);
+            std::uint64_t last = range_length ? first + *range_length : std::numeric_limits<std::uint64_t>::max();
+            decoded = decompress_blocks(header, positional[1], output_file, threads, first, last);
+        }
+    } else {
+        with_symbol_bits(header.symbol_bits, [&](auto bits) {
+            if (mapped_input) {
+                // compressed output is rarely bigger than the input, decompressed output is usually a few times bigger
+                MappedOutputFile output_file(positional[2], mode == 'c' ? mapped_input->size() : mapped_input->size() * 4);
+                if (not output_file.is_open()) {
+                    decoded = false;
+                    return;
+                }
+                error = run_stream<bits>(mode, header, mapped_input->begin(), mapped_input->end(), output_file.writer());
+            } else {
+                auto input_file = std::ifstream(positional[1], std::ifstream::binary);
+                auto output_file = std::ofstream(positional[2], std::ofstream::binary);
+                error = run_stream<bits>(mode, header, std::istreambuf_iterator<char>(input_file), std::istreambuf_iterator<char>(), std::ostreambuf_iterator<char>(output_file));
+            }
+            // files close automatically thanks to RAII
+        });
+    }
+    if (error != DecodeError::NONE) {
+        std::cerr << "Couldn't decompress " << positional[1] << ": " << describe(error) << std::endl;
+        return 1;
+    }
+    if (not decoded) {
+        std::cerr << "Couldn't " << (mode == 'c' ? "compress " : "decompress ") << positional[1] << " to " << positional[2] << std::endl;
+        return 1;
     }
-    std::size_t input_size = input_file.tellg();
-    std::size_t output_size = output_file.tellp();
+    // devices like /dev/null can be read and written, but haven't got a size
+    std::error_code size_error;
+    std::size_t input_size = std::filesystem::file_size(positional[1], size_error);
+    if (size_error) { input_size = 0; }
+    std::size_t output_size = std::filesystem::file_size(positional[2], size_error);
+    if (size_error) { output_size = 0; }
     std::cout << input_size << " bytes -> " << output_size << " bytes (" << std::ceil((double)output_size / input_size * 100) << "%)" << std::endl;
+    LZW_BIT_STAT(if (stats) { print_statistics(start); });
     // std::cout << std::endl;
-    // files close automatically thanks to RAII
 }
@@ -0,0 +1,1991 @@
+#pragma once
+
+// the compression engine, which is header-only so that it can be built into other programs.
+// lzw_bit.cpp is the command-line tool built on it
+
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+template <class Iterable>
+void print_bits(Iterable bits) {
+    for (auto bit : bits) {
+        std::cout << bit;
+    }
+}
+
+// like print_bits() but for multi-bit symbols, which are printed as numbers
+template <class Iterable>
+void print_symbols(Iterable symbols) {
+    for (auto symbol : symbols) {
+        std::cout << (unsigned)symbol << " ";
+    }
+}
+
+#include <cmath>
+
+#include "bit_iterator.hpp"
+#include "statistics.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <optional>
+
+// Fenwick (binary indexed) tree over a growable sequence of flags, supporting
+// rank and select queries in O(log n).
+// CodeTable uses this over node insertion order to track which nodes are
+// coded, so that a codeword is just the rank of its node amongst coded nodes
+// and uncoding one node implicitly renumbers all of those after it.
+class RankSelectTree {
+public:
+    using Count = std::uint32_t;
+    // append a new flag to the end of the sequence
+    void push_back(bool flag) {
+        // 1-based position of the new element in the tree
+        std::size_t i = _flags.size() + 1;
+        _flags.push_back(flag);
+        // a tree cell covers (i - lowbit(i), i], so sum the cells already covering the rest of that range
+        Count sum = flag;
+        std::size_t lowbit = i & -i;
+        for (std::size_t j = i - 1; j > i - lowbit; j -= j & -j) {
+            sum += _tree[j - 1];
+        }
+        _tree.push_back(sum);
+        _count += flag;
+    }
+    // change the flag at the given position
+    void set(std::size_t position, bool flag) {
+        if (_flags[position] == flag) { return; }
+        _flags[position] = flag;
+        for (std::size_t i = position + 1; i <= _tree.size(); i += i & -i) {
+            _tree[i - 1] += flag ? 1 : -1;
+            LZW_BIT_STAT(++statistics().renumbering_steps);
+        }
+        if (flag) { ++_count; } else { --_count; }
+    }
+    // the flag at the given position
+    bool test(std::size_t position) const {
+        return _flags[position];
+    }
+    // number of set flags strictly before the given position
+    std::size_t rank(std::size_t position) const {
+        std::size_t sum = 0;
+        for (std::size_t i = position; i > 0; i -= i & -i) {
+            sum += _tree[i - 1];
+        }
+        return sum;
+    }
+    // position of the set flag with the given (0-based) rank, or nullopt if there are not that many set
+    std::optional<std::size_t> select(std::size_t rank) const {
+        if (rank >= _count) { return std::nullopt; }
+        // descend the implicit tree, skipping whole cells with fewer set flags than we still need
+        std::size_t position = 0;
+        for (std::size_t step = std::bit_floor(_tree.size()); step > 0; step >>= 1) {
+            if (position + step <= _tree.size() and _tree[position + step - 1] <= rank) {
+                position += step;
+                rank -= _tree[position - 1];
+            }
+        }
+        return position;
+    }
+    // number of set flags
+    std::size_t count() const {
+        return _count;
+    }
+    // number of flags
+    std::size_t size() const {
+        return _flags.size();
+    }
+    // remove all flags, keeping any storage allocated
+    void clear() {
+        _tree.clear();
+        _flags.clear();
+        _count = 0;
+    }
+private:
+    // 1-based Fenwick tree cells, stored 0-based
+    std::vector<Count> _tree;
+    std::vector<bool> _flags;
+    std::size_t _count = 0;
+};
+
+// what the code table does once it holds as many entries as it's allowed to
+enum class DictionaryPolicy : std::uint8_t {
+    UNBOUNDED, // no limit, the table grows for as long as there's input
+    FREEZE, // stop adding new codes, keep using the ones already there
+    RESET, // throw away everything learnt and start again from the initial table
+    PRUNE, // evict the least-recently-matched leaf to make room for each new code
+};
+
+// the limit on the size of the code table, which encoder and decoder must agree on
+struct DictionaryLimit {
+    DictionaryPolicy policy = DictionaryPolicy::UNBOUNDED;
+    std::size_t max_entries = 0; // how many strings the table may hold, ignored if UNBOUNDED
+};
+
+// when shadowed codes are dropped from the table, which encoder and decoder must agree on
+enum class RedundantCodeElimination : std::uint8_t {
+    IMMEDIATE, // drop each shadowed code as soon as it's found, one per codeword written
+    // let shadowed codes pile up until the next codeword would need another bit, then drop
+    // them all at once. codewords come out with the same widths, but the table is renumbered far less often
+    BATCHED,
+    // never drop them, so every string keeps its code. codewords are never narrower than with elimination,
+    // but nothing has to be renumbered, which is quicker when little is ever shadowed anyway
+    NONE,
+};
+
+// the most that decompressing a stream from an untrusted source is allowed to cost, each 0 for no limit.
+// a stream of n codes can stand for strings of up to n symbols each, and decoding takes time in proportion
+// to what's written out, so limiting that relative to what's read in stops a small stream taking a worker's time
+struct DecodeLimits {
+    std::uint64_t max_output = 0; // bytes written out in all
+    std::size_t max_entries = 0; // strings in the code table, whatever the stream's own limit says, which bounds its memory
+    std::uint64_t max_expansion = 0; // bytes written out per byte read in, beyond the first EXPANSION_ALLOWANCE bytes
+
+    static constexpr std::uint64_t EXPANSION_ALLOWANCE = 1 << 16;
+};
+
+// why decompressing a stream stopped before the end of it, if it did
+enum class DecodeError : std::uint8_t {
+    NONE,
+    INVALID_CODE, // a code the compressor couldn't have written, so the stream is corrupt
+    TRUNCATED, // the input ran out before the final code
+    OUTPUT_LIMIT, // one of the DecodeLimits would have been exceeded
+    ENTRY_LIMIT,
+    EXPANSION_LIMIT,
+    INVALID_HEADER, // the stream doesn't start with a header that can be decompressed like this
+    WRONG_DICTIONARY, // the stream needs a different preset dictionary, or none
+    OUTPUT_FULL, // there wasn't room for all of the output in the buffer given
+};
+
+inline const char* describe(DecodeError error) {
+    switch (error) {
+    case DecodeError::NONE: return "no error";
+    case DecodeError::INVALID_CODE: return "invalid code";
+    case DecodeError::TRUNCATED: return "truncated stream";
+    case DecodeError::OUTPUT_LIMIT: return "output limit exceeded";
+    case DecodeError::ENTRY_LIMIT: return "code table limit exceeded";
+    case DecodeError::EXPANSION_LIMIT: return "expansion limit exceeded";
+    case DecodeError::INVALID_HEADER: return "invalid header";
+    case DecodeError::WRONG_DICTIONARY: return "wrong preset dictionary";
+    case DecodeError::OUTPUT_FULL: return "output buffer full";
+    }
+    return "unknown error";
+}
+
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+
+// a code table trained ahead of time on sample data, for the compressor and decompressor to both start from
+// instead of just the 1-symbol strings, so that short inputs don't spend most of their length teaching it.
+// it's the trie's nodes in insertion order, after the 1-symbol strings every table starts with, each given as
+// its parent's index and its last symbol. all fields are little-endian, and there are no pointers in it,
+// so the file can be mapped into memory and read in place:
+//   "LZWd", symbol bits (1 byte), 3 zero bytes, id (4 bytes), node count (4 bytes),
+//   parent indices (4 bytes each), symbols (1 byte each)
+// the id is a hash of the contents, which is what compressed streams record to say which dictionary they need
+class PresetDictionary {
+public:
+    static constexpr char MAGIC[4] = {'L', 'Z', 'W', 'd'};
+    static constexpr std::size_t HEADER_SIZE = 16;
+
+    // reads a dictionary straight out of the given memory, which must outlive it, checking that it's
+    // well-formed so that code tables can trust it. returns nullopt if it isn't
+    static std::optional<PresetDictionary> read(const char* first, const char* last) {
+        std::size_t available = last - first;
+        if (available < HEADER_SIZE or not std::equal(std::begin(MAGIC), std::end(MAGIC), first)) { return std::nullopt; }
+        PresetDictionary dictionary;
+        dictionary._symbol_bits = (std::uint8_t)first[4];
+        dictionary._id = _read_little_endian(first + 8);
+        dictionary._size = _read_little_endian(first + 12);
+        if (dictionary._symbol_bits == 0 or 8 % dictionary._symbol_bits != 0) { return std::nullopt; }
+        if (available != HEADER_SIZE + dictionary._size * 5) { return std::nullopt; }
+        dictionary._parents = first + HEADER_SIZE;
+        dictionary._symbols = dictionary._parents + dictionary._size * 4;
+        // every node must extend one that comes before it, by a symbol that nothing else extends it by
+        std::size_t alphabet_size = (std::size_t)1 << dictionary._symbol_bits;
+        std::unordered_set<std::uint64_t> links;
+        for (std::size_t i = 0; i < dictionary._size; ++i) {
+            std::uint64_t parent = dictionary.parent(i);
+            std::uint8_t symbol = dictionary.symbol(i);
+            if (parent == 0 or parent > alphabet_size + i or symbol >= alphabet_size) { return std::nullopt; }
+            if (not links.insert(parent << 8 | symbol).second) { return std::nullopt; }
+        }
+        if (dictionary._id != _hash(dictionary._symbol_bits, dictionary._parents, dictionary._symbols + dictionary._size)) { return std::nullopt; }
+        return dictionary;
+    }
+    // writes out a dictionary of the given nodes, returning its id
+    template <class OutputIterator>
+    static std::uint32_t write(OutputIterator result, std::size_t symbol_bits, const std::vector<std::uint32_t>& parents, const std::vector<std::uint8_t>& symbols) {
+        std::string body;
+        for (std::uint32_t parent : parents) { _write_little_endian(body, parent); }
+        body.append(symbols.begin(), symbols.end());
+        std::uint32_t id = _hash(symbol_bits, body.data(), body.data() + body.size());
+        std::string header(MAGIC, sizeof(MAGIC));
+        header.append({(char)symbol_bits, 0, 0, 0});
+        _write_little_endian(header, id);
+        _write_little_endian(header, (std::uint32_t)parents.size());
+        result = std::copy(header.begin(), header.end(), result);
+        std::copy(body.begin(), body.end(), result);
+        return id;
+    }
+    std::uint32_t id() const {
+        return _id;
+    }
+    std::size_t symbol_bits() const {
+        return _symbol_bits;
+    }
+    // how many nodes there are, besides the 1-symbol strings
+    std::size_t size() const {
+        return _size;
+    }
+    // the index of the given node's parent, counting the trunk and the 1-symbol strings before the first node
+    std::uint32_t parent(std::size_t node) const {
+        return _read_little_endian(_parents + node * 4);
+    }
+    std::uint8_t symbol(std::size_t node) const {
+        return (std::uint8_t)_symbols[node];
+    }
+    // whether a code table starting from this dictionary has room for anything more under the given limit.
+    // one that's full from the start would, under RESET, reload the whole dictionary for every code
+    bool leaves_room(DictionaryLimit limit) const {
+        return limit.policy == DictionaryPolicy::UNBOUNDED or limit.max_entries > ((std::size_t)1 << _symbol_bits) + _size;
+    }
+
+private:
+    static std::uint32_t _read_little_endian(const char* bytes) {
+        return (std::uint32_t)(std::uint8_t)bytes[0] | (std::uint32_t)(std::uint8_t)bytes[1] << 8
+             | (std::uint32_t)(std::uint8_t)bytes[2] << 16 | (std::uint32_t)(std::uint8_t)bytes[3] << 24;
+    }
+    static void _write_little_endian(std::string& bytes, std::uint32_t value) {
+        for (std::size_t i = 0; i < 4; ++i) { bytes.push_back((char)(value >> (i * 8))); }
+    }
+    // 32-bit FNV-1a, never 0 so that 0 can mean "no dictionary"
+    static std::uint32_t _hash(std::size_t symbol_bits, const char* first, const char* last) {
+        std::uint32_t hash = 2166136261u;
+        hash = (hash ^ (std::uint8_t)symbol_bits) * 16777619u;
+        for (; first != last; ++first) {
+            hash = (hash ^ (std::uint8_t)*first) * 16777619u;
+        }
+        return hash == 0 ? 1 : hash;
+    }
+
+    std::uint8_t _symbol_bits = 0;
+    std::uint32_t _id = 0;
+    std::size_t _size = 0;
+    const char* _parents = nullptr;
+    const char* _symbols = nullptr;
+};
+
+#include <bit>
+#include <functional>
+#include <queue>
+#include <type_traits>
+#include <utility>
+
+// the code table's engines, which are how it finds the child of a node for a given symbol --what walking
+// the trie is made of. the table takes one as a template parameter, so it's chosen at compile time and calls
+// to it cost nothing extra. they all give exactly the same codes, so either end of a stream can use any of them
+
+// every node has a link for each possible child, side by side in one flat array, so finding a child
+// is a single lookup, but every node takes up room for all of them even if it has none
+template <std::size_t SYMBOL_BITS>
+class TrieChildren {
+public:
+    using Index = std::uint32_t;
+    using Symbol = std::uint8_t;
+    static constexpr std::size_t ALPHABET_SIZE = (std::size_t)1 << SYMBOL_BITS;
+    static constexpr Index NONE = std::numeric_limits<Index>::max();
+    // approximately how much memory this takes up for each node
+    static constexpr std::size_t BYTES_PER_NODE = sizeof(Index) * ALPHABET_SIZE;
+
+    // the child of the node for the given symbol, NONE if there isn't one
+    Index find(Index node, Symbol c) const {
+        return _children[(std::size_t)node * ALPHABET_SIZE + c];
+    }
+    // links a child to the node, which mustn't already have one for the symbol
+    void insert(Index node, Symbol c, Index child) {
+        _children[(std::size_t)node * ALPHABET_SIZE + c] = child;
+    }
+    void erase(Index node, Symbol c) {
+        _children[(std::size_t)node * ALPHABET_SIZE + c] = NONE;
+    }
+    // makes room for the links of a node just added to the end of the arena
+    void add_node() {
+        _children.insert(_children.end(), ALPHABET_SIZE, NONE);
+    }
+    // forgets every link, leaving room for the given number of nodes, none of which have children
+    void clear(std::size_t nodes) {
+        _children.assign(nodes * ALPHABET_SIZE, NONE);
+    }
+
+private:
+    std::vector<Index> _children;
+};
+
+// one open-addressing hash table of all the links, keyed on (parent, symbol) in the classic LZW style.
+// links are kept in buckets the size of a cache line, probed one after the next, so a lookup mostly
+// touches just the one line, and nodes only take up room for the children they actually have
+template <std::size_t SYMBOL_BITS>
+class HashChildren {
+public:
+    using Index = std::uint32_t;
+    using Symbol = std::uint8_t;
+    static constexpr std::size_t ALPHABET_SIZE = (std::size_t)1 << SYMBOL_BITS;
+    static constexpr Index NONE = std::numeric_limits<Index>::max();
+
+    HashChildren() {
+        clear(0);
+    }
+    Index find(Index node, Symbol c) const {
+        std::uint64_t key = _key(node, c);
+        for (std::size_t b = _bucket(key);; b = (b + 1) & (_buckets.size() - 1)) {
+            const Bucket& bucket = _buckets[b];
+            for (std::size_t i = 0; i < SLOTS; ++i) {
+                if (bucket.keys[i] == key) { return bucket.children[i]; }
+                // slots are filled in probing order and never emptied again, so the key would have been by now
+                if (bucket.keys[i] == EMPTY) { return NONE; }
+            }
+        }
+    }
+    void insert(Index node, Symbol c, Index child) {
+        if ((_used + 1) * 2 > _buckets.size() * SLOTS) { _rehash(); }
+        std::uint64_t key = _key(node, c);
+        for (std::size_t b = _bucket(key);; b = (b + 1) & (_buckets.size() - 1)) {
+            Bucket& bucket = _buckets[b];
+            for (std::size_t i = 0; i < SLOTS; ++i) {
+                if (bucket.keys[i] == EMPTY or bucket.keys[i] == DELETED) {
+                    _used += bucket.keys[i] == EMPTY;
+                    ++_live;
+                    bucket.keys[i] = key;
+                    bucket.children[i] = child;
+                    return;
+                }
+            }
+        }
+    }
+    // leaves a marker in the link's slot, so that probing for the links after it still carries on past it
+    void erase(Index node, Symbol c) {
+        std::uint64_t key = _key(node, c);
+        for (std::size_t b = _bucket(key);; b = (b + 1) & (_buckets.size() - 1)) {
+            Bucket& bucket = _buckets[b];
+            for (std::size_t i = 0; i < SLOTS; ++i) {
+                if (bucket.keys[i] == key) {
+                    bucket.keys[i] = DELETED;
+                    --_live;
+                    return;
+                }
+                if (bucket.keys[i] == EMPTY) { return; }
+            }
+        }
+    }
+    void add_node() {}
+    // forgets every link, keeping the table at its current size
+    void clear(std::size_t) {
+        if (_buckets.empty()) { _buckets.resize(MINIMUM_BUCKETS); }
+        std::fill(_buckets.begin(), _buckets.end(), Bucket());
+        _shift = 64 - std::countr_zero(_buckets.size());
+        _used = _live = 0;
+    }
+
+private:
+    // a cache line of links, empty slots all being at the end
+    static constexpr std::size_t SLOTS = 5;
+    struct alignas(64) Bucket {
+        std::uint64_t keys[SLOTS] = {};
+        Index children[SLOTS] = {};
+    };
+    static constexpr std::uint64_t EMPTY = 0;
+    static constexpr std::uint64_t DELETED = 1;
+    static constexpr std::size_t MINIMUM_BUCKETS = 16;
+
+public:
+    // approximately how much memory this takes up for each node, the table being between a quarter and half full
+    static constexpr std::size_t BYTES_PER_NODE = sizeof(Bucket) / SLOTS * 3;
+
+private:
+    static std::uint64_t _key(Index node, Symbol c) {
+        return ((std::uint64_t)node << SYMBOL_BITS | c) + 2;
+    }
+    // Fibonacci hashing, which takes the top bits of the key times 2^64 over the golden ratio
+    std::size_t _bucket(std::uint64_t key) const {
+        return (key * 0x9e3779b97f4a7c15ull) >> _shift;
+    }
+    // puts every link back in a table big enough that it's no more than a quarter full,
+    // which also clears out any slots that were only marked as deleted
+    void _rehash() {
+        std::vector<Bucket> old(std::max<std::size_t>(MINIMUM_BUCKETS, std::bit_ceil((_live + 1) * 4 / SLOTS + 1)));
+        std::swap(old, _buckets);
+        std::size_t live = _live;
+        clear(0);
+        for (const Bucket& bucket : old) {
+            for (std::size_t i = 0; i < SLOTS; ++i) {
+                if (bucket.keys[i] == EMPTY or bucket.keys[i] == DELETED) { continue; }
+                for (std::size_t b = _bucket(bucket.keys[i]);; b = (b + 1) & (_buckets.size() - 1)) {
+                    auto slot = std::find(_buckets[b].keys, _buckets[b].keys + SLOTS, EMPTY);
+                    if (slot == _buckets[b].keys + SLOTS) { continue; }
+                    *slot = bucket.keys[i];
+                    _buckets[b].children[slot - _buckets[b].keys] = bucket.children[i];
+                    break;
+                }
+            }
+        }
+        _used = _live = live;
+    }
+
+    std::vector<Bucket> _buckets;
+    int _shift;
+    // how many slots hold a link, and how many have ever held one since the last rehash
+    std::size_t _live;
+    std::size_t _used;
+};
+
+// the engine used unless another is asked for. with 8 bits per symbol, the trie's 256 links make every node
+// take up a kilobyte, and the hash table is several times quicker for being so much smaller. at narrower
+// widths the trie's rows are short enough that finding a child in a single lookup wins
+template <std::size_t SYMBOL_BITS>
+using DefaultChildren = std::conditional_t<SYMBOL_BITS == 8, HashChildren<SYMBOL_BITS>, TrieChildren<SYMBOL_BITS>>;
+
+// SYMBOL_BITS is how many bits make up each symbol of the strings in the table
+// 1 is the classic bit-by-bit mode, 2, 4 or 8 process a crumb, nibble or byte per step.
+// Children is the engine for finding a node's children, see TrieChildren, HashChildren and DefaultChildren
+template <std::size_t SYMBOL_BITS = 1, class Children = DefaultChildren<SYMBOL_BITS>>
+class CodeTable {
+    static_assert(SYMBOL_BITS > 0 and 8 % SYMBOL_BITS == 0, "symbols must evenly divide a byte");
+public:
+    // all nodes live in one flat arena and refer to each other by index
+    using Index = std::uint32_t;
+    // a single symbol of a string, stored in the low SYMBOL_BITS bits
+    using Symbol = std::uint8_t;
+    // strings are sequences of symbols
+    using String = std::vector<Symbol>;
+    // how many distinct symbols there are --and so how many children a node can have
+    static constexpr std::size_t ALPHABET_SIZE = (std::size_t)1 << SYMBOL_BITS;
+    // sentinel for "no such node" in child links
+    static constexpr Index NONE = std::numeric_limits<Index>::max();
+    // the trunk of the tree is always the first node in the arena
+    static constexpr Index ROOT = 0;
+    // B+ tree we use for storing the code table nodes --this is most useful for converting strings to codewords
+    // nodes are stored struct-of-arrays, in insertion order, so the "next" node
+    // of any node (regardless of whether it is coded or not) is simply the one
+    // at the following index.
+    struct Nodes {
+        std::vector<Index> parent; // link to parent, only tree trunk and pruned nodes have none
+        Children children; // links to children for each symbol
+        std::vector<Symbol> symbol; // the symbol in the string at the position represented by this node
+        std::vector<std::uint16_t> child_count; // how many of the children links are present
+        std::vector<Index> length; // how many symbols long is the string whose end is marked by this node
+        std::vector<std::uint64_t> last_used; // when this node was last added or matched, only kept when pruning
+        std::vector<Index> jump; // which jump table belongs to this node, if any
+
+        std::size_t size() const {
+            return parent.size();
+        }
+        Index push_back(Index parent_node, Symbol symbol_value, Index length_value) {
+            Index node = (Index)size();
+            parent.push_back(parent_node);
+            children.add_node();
+            symbol.push_back(symbol_value);
+            child_count.push_back(0);
+            length.push_back(length_value);
+            last_used.push_back(0);
+            jump.push_back(NONE);
+            return node;
+        }
+        Index child(Index node, Symbol c) const {
+            return children.find(node, c);
+        }
+        // the children's links aren't kept, as nodes are only ever cut down to size when they've all moved
+        void resize(std::size_t count) {
+            parent.resize(count);
+            children.clear(count);
+            symbol.resize(count);
+            child_count.resize(count);
+            length.resize(count);
+            last_used.resize(count);
+            jump.resize(count);
+        }
+        void clear() {
+            parent.clear();
+            children.clear(0);
+            symbol.clear();
+            child_count.clear();
+            length.clear();
+            last_used.clear();
+            jump.clear();
+        }
+    };
+    // approximately how much memory each entry takes up, for converting limits given in bytes
+    static constexpr std::size_t BYTES_PER_NODE = Children::BYTES_PER_NODE + sizeof(Index) * 3 + sizeof(Symbol)
+                                                + sizeof(std::uint16_t) + sizeof(std::uint64_t) + sizeof(RankSelectTree::Count) + 1;
+    // how many symbols make up a byte, which is how far down the trie a jump goes
+    static constexpr std::size_t JUMP_SYMBOLS = 8 / SYMBOL_BITS;
+    // default constructor, auto-initialises a code table with all 1-symbol strings
+    // and a special "EOF" symbol, followed by everything in the preset dictionary if there is one
+    // (which must outlive the table, as it's loaded again whenever the table is reset)
+    CodeTable(DictionaryLimit limit = {}, RedundantCodeElimination elimination = RedundantCodeElimination::IMMEDIATE, const PresetDictionary* preset = nullptr)
+      : _limit(limit), _elimination(elimination), _preset(preset) {
+        if (_preset and _preset->symbol_bits() != SYMBOL_BITS) {
+            throw std::invalid_argument("preset dictionary has the wrong number of bits per symbol");
+        }
+        _initialise();
+    }
+    // go back to the initial table, with new settings, keeping hold of all the storage allocated so far
+    void reset(DictionaryLimit limit, RedundantCodeElimination elimination, const PresetDictionary* preset = nullptr) {
+        if (preset and preset->symbol_bits() != SYMBOL_BITS) {
+            throw std::invalid_argument("preset dictionary has the wrong number of bits per symbol");
+        }
+        _limit = limit;
+        _elimination = elimination;
+        _preset = preset;
+        _initialise();
+    }
+    // use codetable += <string> to add a code to the table
+    CodeTable& operator+=(const String& string) {
+        // XXX: not checking if code already is present, BE CAREFUL!
+        auto prefix = string;
+        prefix.pop_back();
+        if (auto previous = find(prefix)) {
+            insert(*previous, string.back());
+        } else {
+            throw std::invalid_argument("tried to add new code not prefixed by anything");
+        }
+        return *this;
+    }
+    // add a code for the string of the given node extended by one symbol, returning the new node
+    // this is the same as += but for when the caller already has the prefix node to hand
+    Index insert(Index previous, Symbol c) {
+        // WARN: this *WILL* overwrite existing nodes if not used correctly
+        Index new_node = _add_node(previous, c, _nodes.length[previous] + 1, true);
+        _nodes.children.insert(previous, c, new_node);
+        touch(new_node);
+        LZW_BIT_STAT(++statistics().depths[_nodes.length[new_node]]);
+        // XXX: Optimisation, identify any "shadowed" redundant codes from table
+        // a code is shadowed once every possible next symbol extends it
+        if (++_nodes.child_count[previous] == ALPHABET_SIZE and _coded.test(previous) and _elimination != RedundantCodeElimination::NONE) {
+            _redundant_codes.push_back(previous);
+            LZW_BIT_STAT(++statistics().codes_shadowed);
+        }
+        return new_node;
+    }
+    // step from a node to its child for the given symbol, NONE if there isn't one
+    // the tree trunk is ROOT, so walking from there one symbol at a time is the same as find()
+    Index child(Index node, Symbol c) const {
+        return _nodes.child(node, c);
+    }
+    // find by string, may return nullopt
+    std::optional<Index> find(const String& string) const {
+        Index cursor = ROOT;
+        for (auto c : string) {
+            cursor = _nodes.child(cursor, c);
+            if (cursor == NONE) { return std::nullopt; }
+        }
+        return cursor;
+    }
+    // find by codeword, may return nullopt
+    std::optional<Index> find(std::size_t codeword) const {
+        if (auto node = _coded.select(codeword)) { return (Index)*node; }
+        return std::nullopt;
+    }
+    // remove the code for the given string from the table
+    // NOTE: the string remains present in the table but is now uncoded
+    // all codewords after it implicitly shift down by one, as they are ranks
+    CodeTable& operator-=(std::size_t codeword) {
+        LZW_BIT_STAT(++statistics().uncodes);
+        _coded.set(find(codeword).value(), false);
+        return *this;
+    }
+    // check to see if a string is in the table
+    bool contains(const String& string) const {
+        return find(string).has_value();
+    }
+    // check to see if a code is in the table
+    bool contains(std::size_t codeword) const {
+        return codeword < size();
+    }
+    // retrieve the codeword for the given node, or std::nullopt if it is uncoded
+    std::optional<std::size_t> codeword(Index node) const {
+        if (not _coded.test(node)) { return std::nullopt; }
+        return _coded.rank(node);
+    }
+    // retrieve the codeword for the given string, or std::nullopt if the codeword is uncoded
+    // (NOTE if it's not present at all, which is different to "uncoded", an error is raised)
+    // NOTE: using optional here is just for debugging, it should never return nullopt if our theory is correct
+    // TODO: remove it later and error if it can't be found
+    std::optional<std::size_t> operator[](const String& string) const {
+        return codeword(find(string).value());
+    }
+    // retrieve the string encoded by the given codeword
+    String operator[](std::size_t codeword) const {
+        return string(find(codeword).value());
+    }
+    // how many symbols long the string for the given node is
+    std::size_t length(Index node) const {
+        return _nodes.length[node];
+    }
+    // calls visit(position, symbol) for each symbol of the string for the given node, from the last back
+    // to the first, as that's the order they're found in walking up the trie, and returns the first symbol.
+    // this is how to get at a string without building it
+    template <class Visitor>
+    Symbol spell_backwards(Index node, Visitor visit) const {
+        Symbol first = 0;
+        for (std::size_t position = _nodes.length[node]; position > 0; --position) {
+            first = _nodes.symbol[node];
+            visit(position - 1, first);
+            node = _nodes.parent[node];
+        }
+        return first;
+    }
+    // the node reached by following a whole byte's worth of symbols down from the given one,
+    // or NONE if that hasn't been remembered (which doesn't mean it isn't there)
+    Index jump(Index node, std::uint8_t byte) const {
+        Index table = _nodes.jump[node];
+        return table == NONE ? NONE : _jumps[(std::size_t)table * JUMP_TABLE_SIZE + byte];
+    }
+    // remember that following a byte's worth of symbols down from one node leads to another, for jump().
+    // the jump tables are never allowed to take up more memory than the nodes themselves
+    void remember_jump(Index from, std::uint8_t byte, Index to) {
+        Index table = _nodes.jump[from];
+        if (table == NONE) {
+            if ((_jumps.size() + JUMP_TABLE_SIZE) * sizeof(Index) > _nodes.size() * BYTES_PER_NODE) { return; }
+            table = _nodes.jump[from] = (Index)(_jumps.size() / JUMP_TABLE_SIZE);
+            _jumps.resize(_jumps.size() + JUMP_TABLE_SIZE, NONE);
+        }
+        _jumps[(std::size_t)table * JUMP_TABLE_SIZE + byte] = to;
+    }
+    // writes out everything in the table beyond the 1-symbol strings as a preset dictionary, returning its id
+    template <class OutputIterator>
+    std::uint32_t save(OutputIterator result) const {
+        // pruned nodes are skipped, so the ones after them move down
+        std::vector<Index> remap(_nodes.size(), NONE);
+        std::vector<std::uint32_t> parents;
+        std::vector<std::uint8_t> symbols;
+        Index live = ALPHABET_SIZE + 1;
+        for (Index node = ROOT; node < _nodes.size(); ++node) {
+            if (node > ALPHABET_SIZE and _nodes.parent[node] == NONE) { continue; }
+            remap[node] = node <= ALPHABET_SIZE ? node : live++;
+            if (node > ALPHABET_SIZE) {
+                parents.push_back(remap[_nodes.parent[node]]);
+                symbols.push_back(_nodes.symbol[node]);
+            }
+        }
+        return PresetDictionary::write(result, SYMBOL_BITS, parents, symbols);
+    }
+    // get the string for the given node, which is empty for the trunk or a pruned node
+    String string(Index node) const {
+        String symbols;
+        // follows the parent links rather than trusting the length, so it stops at the trunk whatever happens
+        for (; node != ROOT and node < _nodes.size() and _nodes.parent[node] != NONE; node = _nodes.parent[node]) {
+            symbols.push_back(_nodes.symbol[node]);
+        }
+        std::reverse(symbols.begin(), symbols.end());
+        return symbols;
+    }
+    // uncodes the least recently identified redundant code
+    void drop_oldest_redundant_code() {
+        if (not _redundant_codes.empty()) {
+            Index node = _redundant_codes.front();
+            _redundant_codes.pop_front();
+            // while it was waiting, pruning may have taken one of its children away, so it's needed again
+            // (dead nodes have no children, so this also skips any that were pruned themselves)
+            if (_nodes.child_count[node] == ALPHABET_SIZE) {
+                _coded.set(node, false);
+                LZW_BIT_STAT(++statistics().codes_dropped; ++statistics().uncodes);
+            }
+        }
+    }
+    // drops redundant codes as the elimination mode says to, once per codeword written or read
+    void drop_redundant_codes() {
+        if (_elimination == RedundantCodeElimination::IMMEDIATE) {
+            drop_oldest_redundant_code();
+            return;
+        }
+        // +1 for the "END" symbol and +1 for the code about to be added
+        if (bits_needed(size() + 2) > bits_needed(size() + 1)) {
+            while (not _redundant_codes.empty()) {
+                drop_oldest_redundant_code();
+            }
+        }
+    }
+    // uncodes every string that's shadowed, straight away, whatever the elimination mode.
+    // for starting from a table that wasn't built up by the encoder and decoder in step,
+    // which drop codes as they go, so both ends need to agree on which are coded
+    void drop_all_redundant_codes() {
+        _redundant_codes.clear();
+        if (_elimination == RedundantCodeElimination::NONE) { return; }
+        for (Index node = ROOT + 1; node < _nodes.size(); ++node) {
+            if (_nodes.child_count[node] == ALPHABET_SIZE and _coded.test(node)) {
+                _coded.set(node, false);
+                LZW_BIT_STAT(++statistics().codes_dropped; ++statistics().uncodes);
+            }
+        }
+    }
+    // give codes back to any uncoded (dropped) strings from the table
+    // NOTE: strings are not guaranteed to get back their original codewords
+    void restore_dropped_codes() {
+        // every node except the trunk (and any pruned ones) becomes coded again, numbered in insertion order
+        for (Index node = ROOT + 1; node < _nodes.size(); ++node) {
+            if (_nodes.parent[node] != NONE and not _coded.test(node)) {
+                _coded.set(node, true);
+                LZW_BIT_STAT(++statistics().codes_restored);
+            }
+        }
+    }
+    // mark the given node as having just been matched, for the PRUNE policy's benefit
+    // encoder and decoder must touch the same nodes in the same order to stay in sync
+    void touch(Index node) {
+        if (_limit.policy != DictionaryPolicy::PRUNE) { return; }
+        _nodes.last_used[node] = ++_clock;
+        if (_evictable(node)) { _leaves.emplace(_nodes.last_used[node], node); }
+    }
+    // apply the dictionary limit ahead of adding a new code under the given node,
+    // returning whether the code should be added at all.
+    // depending on policy, this may evict an entry or reset the whole table.
+    // NOTE: the node index is updated in case the table gets compacted, but if the table
+    // is reset it refers to nothing any more.
+    bool make_room(Index& cursor) {
+        if (_limit.policy == DictionaryPolicy::UNBOUNDED or entries() < _limit.max_entries) { return true; }
+        switch (_limit.policy) {
+        case DictionaryPolicy::RESET:
+            _initialise();
+            return false;
+        case DictionaryPolicy::PRUNE:
+            if (Index victim = _least_recently_used_leaf(cursor); victim != NONE) {
+                _evict(victim);
+                // pruned nodes are left behind in the arena, so once they outnumber the live ones, squash them out
+                if (_nodes.size() - 1 - entries() > entries()) { _compact(cursor); }
+                return true;
+            }
+            return false; // no leaf to evict, so behave as if frozen for now
+        default:
+            return false;
+        }
+    }
+    // returns the number of strings stored in the table, whether coded or not
+    // this is what the dictionary limit applies to
+    std::size_t entries() const {
+        return _entries;
+    }
+    // returns the number of *coded* strings in the table. This can be less than
+    // the total number of strings stored in the table, if for example any have
+    // been uncoded.
+    // Knowing the number of assigned codes is essential for serialising and
+    // deserialising codewords in a space-efficient way.
+    std::size_t size() const {
+        return _coded.count();
+    }
+    void print() const {
+        std::cout << "==========================================" << std::endl;
+        for (Index node = ROOT + 1; node < _nodes.size(); ++node) {
+            if (_nodes.parent[node] == NONE) { continue; }
+            if (auto code = codeword(node)) {
+                std::cout << *code;
+            }
+            std::cout << "\t";
+            print_symbols(string(node));
+            std::cout << std::endl;
+        }
+    }
+private:
+    // sets up the initial table of all 1-symbol strings, reusing any storage already allocated
+    void _initialise() {
+        _nodes.clear();
+        _coded.clear();
+        _redundant_codes.clear();
+        _leaves = {};
+        _jumps.clear();
+        _entries = 0;
+        _add_node(NONE, 0, 0, false); // special non-symbol node that represents the trunk of the tree
+        for (std::size_t c = 0; c < ALPHABET_SIZE; ++c) {
+            _nodes.children.insert(ROOT, (Symbol)c, _add_node(ROOT, (Symbol)c, 1, true));
+        }
+        _nodes.child_count[ROOT] = ALPHABET_SIZE;
+        if (_preset) { _load(*_preset); }
+    }
+    // adds every node of a preset dictionary, which has already been checked to be well-formed.
+    // nodes that every symbol extends are shadowed from the start, so both ends agree on which are coded
+    void _load(const PresetDictionary& preset) {
+        for (std::size_t i = 0; i < preset.size(); ++i) {
+            Index parent = preset.parent(i);
+            Symbol c = preset.symbol(i);
+            _nodes.children.insert(parent, c, _add_node(parent, c, _nodes.length[parent] + 1, true));
+            ++_nodes.child_count[parent];
+        }
+        drop_all_redundant_codes();
+        if (_limit.policy == DictionaryPolicy::PRUNE) { _rebuild_leaves(); }
+    }
+    // appends a node to the arena, tracking whether it is coded or not
+    Index _add_node(Index parent, Symbol c, Index length, bool coded) {
+        _coded.push_back(coded);
+        if (parent != NONE) { ++_entries; }
+        Index node = _nodes.push_back(parent, c, length);
+        LZW_BIT_STAT(statistics().peak_dictionary_bytes = std::max<std::uint64_t>(statistics().peak_dictionary_bytes, _nodes.size() * BYTES_PER_NODE));
+        return node;
+    }
+    // only leaves can be pruned, and never the 1-symbol strings everything else is built on
+    bool _evictable(Index node) const {
+        return _nodes.parent[node] != NONE and _nodes.child_count[node] == 0 and _nodes.length[node] > 1;
+    }
+    // finds the leaf that was least recently matched, other than the one given, or NONE if there are none
+    Index _least_recently_used_leaf(Index exclude) {
+        // the heap is lazy, entries for nodes that have since been matched again or grown children are skipped
+        std::optional<std::pair<std::uint64_t, Index>> excluded;
+        Index victim = NONE;
+        while (not _leaves.empty() and victim == NONE) {
+            auto [time, node] = _leaves.top();
+            _leaves.pop();
+            if (not _evictable(node) or _nodes.last_used[node] != time) { continue; }
+            if (node == exclude) {
+                excluded.emplace(time, node);
+            } else {
+                victim = node;
+            }
+        }
+        if (excluded) { _leaves.push(*excluded); }
+        // stale entries accumulate for leaves that keep being matched, so rebuild if they've taken over
+        if (_leaves.size() > 4 * entries()) { _rebuild_leaves(); }
+        return victim;
+    }
+    void _rebuild_leaves() {
+        std::vector<std::pair<std::uint64_t, Index>> leaves;
+        for (Index node = ROOT + 1; node < _nodes.size(); ++node) {
+            if (_evictable(node)) { leaves.emplace_back(_nodes.last_used[node], node); }
+        }
+        _leaves = decltype(_leaves)(std::greater<>(), std::move(leaves));
+    }
+    // removes a leaf from the table entirely, leaving its slot in the arena dead
+    void _evict(Index node) {
+        _forget_jumps_to(node);
+        Index previous = _nodes.parent[node];
+        _nodes.children.erase(previous, _nodes.symbol[node]);
+        _nodes.parent[node] = NONE;
+        LZW_BIT_STAT(statistics().uncodes += _coded.test(node));
+        _coded.set(node, false);
+        --_entries;
+        --_nodes.child_count[previous];
+        // a shadowed prefix can be matched on its own again now that not every symbol extends it
+        if (previous != ROOT and not _coded.test(previous)) { _coded.set(previous, true); }
+        if (_evictable(previous)) { _leaves.emplace(_nodes.last_used[previous], previous); }
+    }
+    // any jump that leads to the given node starts a byte's worth of symbols above it, along the path to it
+    void _forget_jumps_to(Index node) {
+        std::uint8_t byte = 0;
+        Index from = node;
+        for (std::size_t step = 0; step < JUMP_SYMBOLS; ++step) {
+            if (from == ROOT) { return; }
+            byte |= _nodes.symbol[from] << (step * SYMBOL_BITS);
+            from = _nodes.parent[from];
+        }
+        if (_nodes.jump[from] != NONE) { _jumps[(std::size_t)_nodes.jump[from] * JUMP_TABLE_SIZE + byte] = NONE; }
+    }
+    // moves all live nodes down over the dead ones, preserving their order and so also their codewords
+    // done in place, as no node ever moves up
+    void _compact(Index& cursor) {
+        std::vector<Index> remap(_nodes.size(), NONE);
+        std::vector<bool> coded;
+        Index live = 0;
+        for (Index node = ROOT; node < _nodes.size(); ++node) {
+            if (node == ROOT or _nodes.parent[node] != NONE) {
+                remap[node] = live++;
+                coded.push_back(_coded.test(node));
+            }
+        }
+        for (Index node = ROOT; node < _nodes.size(); ++node) {
+            Index to = remap[node];
+            if (to == NONE) { continue; }
+            _nodes.parent[to] = node == ROOT ? NONE : remap[_nodes.parent[node]];
+            _nodes.symbol[to] = _nodes.symbol[node];
+            _nodes.child_count[to] = _nodes.child_count[node];
+            _nodes.length[to] = _nodes.length[node];
+            _nodes.last_used[to] = _nodes.last_used[node];
+            // the jump tables are all full of old indices, so they start again from scratch
+            _nodes.jump[to] = NONE;
+        }
+        // every node is linked from its parent again, at their new indices
+        _nodes.resize(live);
+        for (Index node = ROOT + 1; node < live; ++node) {
+            _nodes.children.insert(_nodes.parent[node], _nodes.symbol[node], node);
+        }
+        _jumps.clear();
+        _coded.clear();
+        for (bool flag : coded) { _coded.push_back(flag); }
+        // anything waiting to be dropped might since have been pruned itself
+        std::erase_if(_redundant_codes, [&](Index node) { return remap[node] == NONE; });
+        for (auto& node : _redundant_codes) { node = remap[node]; }
+        cursor = remap[cursor];
+        _rebuild_leaves();
+    }
+    // jump tables have an entry for every possible byte
+    static constexpr std::size_t JUMP_TABLE_SIZE = 256;
+    // the limit on how many strings the table can hold
+    DictionaryLimit _limit;
+    RedundantCodeElimination _elimination;
+    // what the table starts out with besides the 1-symbol strings, if anything
+    const PresetDictionary* _preset;
+    // useful for converting strings to codewords, and stores the actual code table
+    Nodes _nodes;
+    // which nodes are coded, in insertion order --a node's codeword is its rank in here
+    // this is also what's used for converting codewords to strings, by selecting on it
+    RankSelectTree _coded;
+    // sequence of nodes whose codes are due for future removal, oldest first.
+    // IMMEDIATE drops them one per codeword, BATCHED lets them pile up until the next codeword would need another bit
+    std::deque<Index> _redundant_codes;
+    // number of live nodes, not counting the trunk
+    std::size_t _entries = 0;
+    // min-heap of leaves by when they were last used, only maintained when pruning
+    std::priority_queue<std::pair<std::uint64_t, Index>, std::vector<std::pair<std::uint64_t, Index>>, std::greater<>> _leaves;
+    // ticks every time a node is added or matched
+    std::uint64_t _clock = 0;
+    // jump tables for walking the trie a byte at a time, end to end
+    std::vector<Index> _jumps;
+};
+
+#include <span>
+
+// how codewords are turned into bits. the compressor and decompressor always agree on how
+// many codewords are possible at each point, so each one only needs to say which of those it is
+enum class CodewordPacking : std::uint8_t {
+    // just enough bits for the number of possible codewords, most significant bit first
+    BINARY,
+    // phase-in (truncated binary) codes: when the number of possible codewords isn't a power of two,
+    // the smaller ones are written with one bit fewer, so less than a bit is wasted on average
+    PHASE_IN,
+    // mixed-base packing: each codeword is a digit in the base of however many were possible,
+    // and the whole run of them is packed into bytes as one number. this wastes almost nothing,
+    // but it's done with a range coder, as the decoder only learns each base after decoding the last digit
+    DENSE,
+};
+
+// writes and reads codewords in the bitstream according to the chosen packing
+// NOTE: the compressor and decompressor work on bitstreams read and written
+// through bit_reader and bit_writer, and each needs its own one of these
+class CodewordSerialiser {
+public:
+    CodewordSerialiser(CodewordPacking packing = CodewordPacking::BINARY) : _packing(packing) {}
+
+    // write a codeword, out of space_size possible ones
+    template <class BitWriter>
+    void put(BitWriter& output, std::uint64_t codeword, std::uint64_t space_size) {
+        LZW_BIT_STAT(++statistics().codewords_by_width[bits_needed(space_size)]);
+        switch (_packing) {
+        case CodewordPacking::BINARY:
+            output.put_bits(codeword, bits_needed(space_size));
+            break;
+        case CodewordPacking::PHASE_IN: {
+            if (space_size <= 1) { return; }
+            std::size_t short_width = std::bit_width(space_size) - 1;
+            // how many codewords get the shorter width
+            std::uint64_t short_count = (std::uint64_t(2) << short_width) - space_size;
+            if (codeword < short_count) {
+                output.put_bits(codeword, short_width);
+            } else {
+                output.put_bits(codeword + short_count, short_width + 1);
+            }
+            break;
+        }
+        case CodewordPacking::DENSE:
+            _put_digits(output, codeword, space_size);
+            break;
+        }
+    }
+    // read a codeword, out of space_size possible ones, or nullopt if the stream ends before a whole one.
+    // nothing is read unless a whole codeword is, so this can be called again once more input arrives
+    template <class BitReader>
+    std::optional<std::uint64_t> get(BitReader& input, std::uint64_t space_size) {
+        auto codeword = _get(input, space_size);
+        LZW_BIT_STAT(if (codeword) { ++statistics().codewords_by_width[bits_needed(space_size)]; });
+        return codeword;
+    }
+    // write out whatever's needed to finish off the codewords written so far
+    template <class BitWriter>
+    void flush(BitWriter& output) {
+        if (_packing == CodewordPacking::DENSE) {
+            for (std::size_t i = 0; i < 5; ++i) {
+                _shift_low(output);
+            }
+        }
+    }
+    // whether part of a codeword has been read, and is held until the rest of it arrives
+    bool holding() const {
+        return not _held.empty();
+    }
+    // get ready to write or read a new stream of codewords, after flush() or the end of the last one
+    void restart() {
+        _encoder = {};
+        _decoder = {};
+        _held.clear();
+        _held_read = 0;
+    }
+
+private:
+    template <class BitReader>
+    std::optional<std::uint64_t> _get(BitReader& input, std::uint64_t space_size) {
+        switch (_packing) {
+        case CodewordPacking::BINARY:
+            return input.get_bits(bits_needed(space_size));
+        case CodewordPacking::PHASE_IN: {
+            if (space_size <= 1) { return 0; }
+            std::size_t short_width = std::bit_width(space_size) - 1;
+            std::uint64_t short_count = (std::uint64_t(2) << short_width) - space_size;
+            auto prefix = input.peek_bits(short_width);
+            if (not prefix) { return std::nullopt; }
+            if (*prefix < short_count) {
+                input.skip_bits(short_width);
+                return prefix;
+            }
+            auto codeword = input.get_bits(short_width + 1);
+            if (not codeword) { return std::nullopt; }
+            return *codeword - short_count;
+        }
+        case CodewordPacking::DENSE: {
+            // a codeword can take several bytes, so if they run out part-way, go back to how things were
+            // and keep the bytes read so far to go through again when the rest arrive
+            RangeDecoder saved = _decoder;
+            auto codeword = _get_digits(input, space_size);
+            if (codeword) {
+                _held.clear();
+            } else {
+                _decoder = saved;
+            }
+            _held_read = 0;
+            return codeword;
+        }
+        }
+        return std::nullopt;
+    }
+    // the range coder can only divide its range so finely, so bigger bases are split up
+    // into a base of at most this much for the top of the codeword, and bits for the rest
+    static constexpr std::uint64_t MAX_DIGIT_BASE = 1 << 16;
+    // the range is topped up a byte at a time whenever it falls below this
+    static constexpr std::uint32_t RANGE_BOTTOM = 1 << 24;
+
+    template <class BitWriter>
+    void _put_digits(BitWriter& output, std::uint64_t codeword, std::uint64_t space_size) {
+        std::size_t rest = space_size > MAX_DIGIT_BASE ? bits_needed(space_size) - 16 : 0;
+        _put_digit(output, codeword >> rest, ((space_size - 1) >> rest) + 1);
+        while (rest > 0) {
+            std::size_t width = std::min<std::size_t>(rest, 16);
+            rest -= width;
+            _put_digit(output, (codeword >> rest) & ((1u << width) - 1), 1u << width);
+        }
+    }
+    template <class BitReader>
+    std::optional<std::uint64_t> _get_digits(BitReader& input, std::uint64_t space_size) {
+        if (not _decoder.started) {
+            // the first byte is always the encoder's empty carry byte
+            for (std::size_t i = 0; i < 5; ++i) {
+                auto byte = _get_byte(input);
+                if (not byte) { return std::nullopt; }
+                _decoder.code = _decoder.code << 8 | *byte;
+            }
+            _decoder.started = true;
+        }
+        std::size_t rest = space_size > MAX_DIGIT_BASE ? bits_needed(space_size) - 16 : 0;
+        auto codeword = _get_digit(input, ((space_size - 1) >> rest) + 1);
+        while (codeword and rest > 0) {
+            std::size_t width = std::min<std::size_t>(rest, 16);
+            rest -= width;
+            auto digit = _get_digit(input, 1u << width);
+            if (not digit) { return std::nullopt; }
+            *codeword = *codeword << width | *digit;
+        }
+        return codeword;
+    }
+    // narrows the range down to the digit's share of it, sending out bytes as they're settled
+    template <class BitWriter>
+    void _put_digit(BitWriter& output, std::uint64_t digit, std::uint64_t base) {
+        if (base <= 1) { return; }
+        _encoder.range /= base;
+        _encoder.low += digit * _encoder.range;
+        while (_encoder.range < RANGE_BOTTOM) {
+            _encoder.range <<= 8;
+            _shift_low(output);
+        }
+    }
+    template <class BitReader>
+    std::optional<std::uint64_t> _get_digit(BitReader& input, std::uint64_t base) {
+        if (base <= 1) { return 0; }
+        _decoder.range /= base;
+        std::uint64_t digit = _decoder.code / _decoder.range;
+        // only a corrupt stream can give a digit out of range, but it mustn't be allowed to wrap around
+        if (digit >= base) { return base; }
+        _decoder.code -= digit * _decoder.range;
+        while (_decoder.range < RANGE_BOTTOM) {
+            auto byte = _get_byte(input);
+            if (not byte) { return std::nullopt; }
+            _decoder.range <<= 8;
+            _decoder.code = _decoder.code << 8 | *byte;
+        }
+        return digit;
+    }
+    // the next byte for the range decoder, going through any held from an earlier attempt first
+    template <class BitReader>
+    std::optional<std::uint64_t> _get_byte(BitReader& input) {
+        if (_held_read < _held.size()) { return _held[_held_read++]; }
+        auto byte = input.get_bits(8);
+        if (byte) {
+            _held.push_back(*byte);
+            ++_held_read;
+        }
+        return byte;
+    }
+    // sends out the top byte of low, unless it might still be changed by a carry,
+    // in which case it's held back (along with any 0xFF bytes after it) until that's known
+    template <class BitWriter>
+    void _shift_low(BitWriter& output) {
+        if ((std::uint32_t)_encoder.low < 0xFF000000 or (_encoder.low >> 32) != 0) {
+            std::uint8_t carry = _encoder.low >> 32;
+            std::uint8_t held = _encoder.cache;
+            do {
+                output.put_bits((std::uint8_t)(held + carry), 8);
+                held = 0xFF;
+            } while (--_encoder.cache_size != 0);
+            _encoder.cache = (std::uint8_t)(_encoder.low >> 24);
+        }
+        ++_encoder.cache_size;
+        _encoder.low = (_encoder.low & 0x00FFFFFF) << 8;
+    }
+
+    struct RangeEncoder {
+        std::uint64_t low = 0;
+        std::uint32_t range = 0xFFFFFFFF;
+        std::uint8_t cache = 0;
+        std::uint64_t cache_size = 1;
+    };
+    struct RangeDecoder {
+        std::uint32_t code = 0;
+        std::uint32_t range = 0xFFFFFFFF;
+        bool started = false;
+    };
+    CodewordPacking _packing;
+    RangeEncoder _encoder;
+    RangeDecoder _decoder;
+    // bytes read while decoding the current codeword, and how many of them have been gone through this attempt
+    std::vector<std::uint8_t> _held;
+    std::size_t _held_read = 0;
+};
+
+// holds the state of the compressor between symbols, so that it can be fed
+// input a piece at a time --either a symbol at a time through encode(), or
+// push-style through write() and finish() with caller-provided buffers.
+// Children is the code table's engine, see TrieChildren and HashChildren
+template <std::size_t SYMBOL_BITS = 1, class Children = DefaultChildren<SYMBOL_BITS>>
+class LzwBitEncoder {
+public:
+    using Table = CodeTable<SYMBOL_BITS, Children>;
+    // how much of the input and output buffers a call to write() used
+    struct Progress {
+        std::size_t consumed;
+        std::size_t produced;
+    };
+
+    LzwBitEncoder(DictionaryLimit limit = {}, CodewordPacking packing = CodewordPacking::BINARY, RedundantCodeElimination elimination = RedundantCodeElimination::IMMEDIATE, const PresetDictionary* preset = nullptr)
+      : _string_table(limit, elimination, preset), _codewords(packing) {}
+    // non-copyable and non-movable, as the internal bit writer refers to our own buffer
+    LzwBitEncoder(const LzwBitEncoder&) = delete;
+    LzwBitEncoder& operator=(const LzwBitEncoder&) = delete;
+
+    // compress the next symbol of input, writing out a codeword if it ends the current match
+    template <class BitWriter>
+    void encode(typename Table::Symbol c, BitWriter& output) {
+        // string_table.print();
+        typename Table::Index pc = _string_table.child(_p, c);
+        if (pc != Table::NONE) {
+            _p = pc;
+        } else {
+            // print_symbols(_string_table.string(_p));
+            // std::cout << " -> " << *_string_table.codeword(_p) << std::endl;
+            ++_written;
+            {
+                LZW_BIT_STAT_TIMER(emit_time);
+                // NOTE: +1 is to account for the special "END" symbol, not in table
+                _codewords.put(output, *_string_table.codeword(_p), _string_table.size() + 1);
+                _string_table.touch(_p);
+            }
+            LZW_BIT_STAT(++statistics().matches; statistics().matched_symbols += _string_table.length(_p));
+            {
+                LZW_BIT_STAT_TIMER(rce_time);
+                _string_table.drop_redundant_codes();
+            }
+            {
+                LZW_BIT_STAT_TIMER(dictionary_time);
+                // the dictionary limit decides whether there's room for the new code
+                if (_string_table.make_room(_p)) {
+                    _string_table.insert(_p, c);
+                }
+            }
+            _p = _string_table.child(Table::ROOT, c);
+        }
+        // string_table.print();
+    }
+    // compress the next byte of input, a symbol at a time unless the whole byte just carries on the current
+    // match, in which case the code table can often jump straight to where it leads without walking there
+    template <class BitWriter>
+    void encode_byte(std::uint8_t byte, BitWriter& output) {
+        if constexpr (Table::JUMP_SYMBOLS > 1) {
+            if (auto next = _string_table.jump(_p, byte); next != Table::NONE) {
+                _p = next;
+                return;
+            }
+        }
+        typename Table::Index start = _p;
+        std::uint64_t written = _written;
+        for (std::size_t shift = 8; shift > 0; shift -= SYMBOL_BITS) {
+            encode((typename Table::Symbol)((byte >> (shift - SYMBOL_BITS)) & (Table::ALPHABET_SIZE - 1)), output);
+        }
+        if constexpr (Table::JUMP_SYMBOLS > 1) {
+            // a jump can only stand in for a walk that carried the match on through the whole byte
+            if (_written == written) {
+                _string_table.remember_jump(start, byte, _p);
+            }
+        }
+    }
+    // the code table as it stands, which is everything learnt from the input so far
+    const Table& string_table() const {
+        return _string_table;
+    }
+    // write out the codes that finish off the stream, after the last symbol of input
+    template <class BitWriter>
+    void end(BitWriter& output) {
+        // an empty input has nothing to encode, not even "END"
+        if (_p == Table::ROOT) { return; }
+        // print_symbols(_string_table.string(_p));
+        // std::cout << " -> END" << std::endl;
+        // send out the "END" code
+        _codewords.put(output, _string_table.size(), _string_table.size() + 1);
+        {
+            LZW_BIT_STAT_TIMER(rce_time);
+            // restore all previously-dropped symbol codes
+            _string_table.restore_dropped_codes();
+        }
+        LZW_BIT_STAT(++statistics().matches; statistics().matched_symbols += _string_table.length(_p));
+        // write out last remaining symbol left on output
+        _codewords.put(output, *_string_table.codeword(_p), _string_table.size());
+        // the decoder touches it too, which matters if the table carries on after a restart()
+        _string_table.touch(_p);
+        _codewords.flush(output);
+    }
+    // start compressing a new stream from scratch, with new settings, reusing the storage of the old code table
+    void reset(DictionaryLimit limit = {}, CodewordPacking packing = CodewordPacking::BINARY, RedundantCodeElimination elimination = RedundantCodeElimination::IMMEDIATE, const PresetDictionary* preset = nullptr) {
+        _string_table.reset(limit, elimination, preset);
+        _codewords = CodewordSerialiser(packing);
+        _p = Table::ROOT;
+        _pending.clear();
+        _pending_start = 0;
+        _writer = decltype(_writer)(std::back_inserter(_pending));
+        _finished = false;
+    }
+    // start compressing a new stream after end(), which carries on with the code table learnt so far,
+    // for a decoder that's restarted at the same point. not for the push-style interface
+    void restart() {
+        _p = Table::ROOT;
+        _codewords.restart();
+        _string_table.drop_all_redundant_codes();
+    }
+    // compress as much of input as there's room in output for.
+    // output is held back internally only for as long as output is full, and never
+    // more than a few words of it, so memory use doesn't depend on how much input there is.
+    Progress write(std::span<const std::byte> input, std::span<std::byte> output) {
+        Progress progress = {0, _drain(output)};
+        // only take more input once everything from the last lot has gone out
+        while (progress.consumed < input.size() and _pending.empty()) {
+            encode_byte((std::uint8_t)input[progress.consumed++], _writer);
+            progress.produced += _drain(output.subspan(progress.produced));
+        }
+        return progress;
+    }
+    // send out any whole bytes of compressed output held back so far, returning how many were written.
+    // if output fills up, call again with more room until pending() is false.
+    std::size_t flush(std::span<std::byte> output) {
+        _writer.flush_whole_chars();
+        return _drain(output);
+    }
+    // finish off the stream and send out the rest of the compressed output, returning how many bytes were written.
+    // no more input can be written after this. if output fills up, call again with more room until pending() is false.
+    std::size_t finish(std::span<std::byte> output) {
+        if (not _finished) {
+            end(_writer);
+            _writer.flush();
+            _finished = true;
+        }
+        return _drain(output);
+    }
+    // whether there's compressed output held back waiting for room
+    bool pending() const {
+        return not _pending.empty();
+    }
+
+private:
+    // moves as much held-back output as will fit into the given buffer
+    std::size_t _drain(std::span<std::byte> output) {
+        std::size_t count = std::min(output.size(), _pending.size() - _pending_start);
+        std::copy_n((const std::byte*)_pending.data() + _pending_start, count, output.begin());
+        _pending_start += count;
+        if (_pending_start == _pending.size()) {
+            _pending.clear();
+            _pending_start = 0;
+        }
+        return count;
+    }
+
+    Table _string_table;
+    CodewordSerialiser _codewords;
+    // cursor into the code table for the longest string matched so far
+    typename Table::Index _p = Table::ROOT;
+    // how many codewords have been written, which tells encode_byte() whether the match was broken
+    std::uint64_t _written = 0;
+    // only used by the push-style interface
+    std::vector<char> _pending;
+    std::size_t _pending_start = 0;
+    bit_writer<std::back_insert_iterator<std::vector<char>>> _writer{std::back_inserter(_pending)};
+    bool _finished = false;
+};
+
+// holds the state of the decompressor between codes, so that it can be fed
+// input a piece at a time --either a code at a time through decode(), or
+// push-style through write() and finish() with caller-provided buffers.
+// Children is the code table's engine, which needn't be the same as the encoder's
+template <std::size_t SYMBOL_BITS = 1, class Children = DefaultChildren<SYMBOL_BITS>>
+class LzwBitDecoder {
+public:
+    using Table = CodeTable<SYMBOL_BITS, Children>;
+    using Progress = typename LzwBitEncoder<SYMBOL_BITS, Children>::Progress;
+
+    LzwBitDecoder(DictionaryLimit limit = {}, CodewordPacking packing = CodewordPacking::BINARY, RedundantCodeElimination elimination = RedundantCodeElimination::IMMEDIATE, const PresetDictionary* preset = nullptr)
+      : _string_table(limit, elimination, preset), _codewords(packing) {}
+    // non-copyable and non-movable, as the internal bit writer refers to our own buffer
+    LzwBitDecoder(const LzwBitDecoder&) = delete;
+    LzwBitDecoder& operator=(const LzwBitDecoder&) = delete;
+
+    // how many different codes the next one could be
+    std::uint64_t next_code_space() {
+        // the compressor adds a code before writing the next one, but we can only add it after reading that code
+        // the table gets ready for that here, and only once per code
+        if (not _prepared and not _ended) {
+            LZW_BIT_STAT_TIMER(dictionary_time);
+            _adding = _w != Table::NONE and _string_table.make_room(_w);
+        }
+        _prepared = true;
+        // +1 to table size if a new code is about to be added to the table
+        // additional +1 is to account for the special "END" symbol, which is not in table
+        // (but after "END" the final code is sized without it)
+        return _string_table.size() + _adding + not _ended;
+    }
+    // read the next code from the bitstream, or nullopt if there isn't a whole one there yet
+    template <class BitReader>
+    std::optional<std::uint64_t> read_code(BitReader& input) {
+        return _codewords.get(input, next_code_space());
+    }
+    // decompress the next code, writing out the string it stands for
+    // returns false once there's nothing more to decode, either because that was
+    // the final code or because it's not one the compressor could have written
+    template <class BitWriter>
+    bool decode(std::uint64_t k, BitWriter& output) {
+        if (_done) { return false; }
+        std::uint64_t space = next_code_space();
+        _prepared = false;
+        // every packing takes at least this many bits for a code, which is what expansion is measured against
+        _input_bits += std::bit_width(space) - 1;
+        // string_table.print();
+        if (not _ended and k == _string_table.size() + _adding) { // "END" symbol encountered
+            // std::cout << "END" << std::endl;
+            LZW_BIT_STAT_TIMER(rce_time);
+            _string_table.restore_dropped_codes();
+            _ended = true;
+            return true;
+        }
+        // std::cout << k << " -> ";
+        typename Table::Index found;
+        if (auto node = _string_table.find(k)) {
+            found = *node;
+            if (not _within_limits(_string_table.length(found))) { return false; }
+            auto first = _emit(found, false, output);
+            if (_adding) {
+                LZW_BIT_STAT_TIMER(dictionary_time);
+                _string_table.insert(_w, first);
+            }
+        } else if (_adding and k == _string_table.size()) {
+            // the code being added right now, which can only be w extended by its own first symbol
+            if (not _within_limits(_string_table.length(_w) + 1)) { return false; }
+            auto first = _emit(_w, true, output);
+            found = _string_table.insert(_w, first);
+        } else {
+            return _fail(DecodeError::INVALID_CODE);
+        }
+        LZW_BIT_STAT(++statistics().matches; statistics().matched_symbols += _string_table.length(found));
+        // print_symbols(_string_table.string(found));
+        // std::cout << std::endl;
+        _string_table.touch(found);
+        {
+            LZW_BIT_STAT_TIMER(rce_time);
+            _string_table.drop_redundant_codes();
+        }
+        _w = found;
+        // string_table.print();
+        // anything left after the final code is padding
+        _done = _ended;
+        return not _done;
+    }
+    // makes decode() stop with an error rather than go beyond any of the limits, which go on applying
+    // to each stream after reset() or restart(). checking them costs next to nothing
+    void set_limits(const DecodeLimits& limits) {
+        _limits = limits;
+        _max_output_symbols = limits.max_output == 0 ? std::numeric_limits<std::uint64_t>::max() : limits.max_output * 8 / SYMBOL_BITS;
+        _max_entries = limits.max_entries == 0 ? std::numeric_limits<std::size_t>::max() : limits.max_entries;
+    }
+    // why decoding stopped before the final code, if it did. the push-style interface only knows
+    // whether the input was truncated once finish() has been called, and decode() never does
+    DecodeError error() const {
+        return _error;
+    }
+    // notes that there's no more input to come, returning the error if that means the stream was cut short.
+    // bits_left is whether there was input left over that didn't make up a whole code. a stream with nothing
+    // at all after the header is the empty one, but one with only part of a code is cut short
+    DecodeError end_of_input(bool bits_left = false) {
+        bool started = _w != Table::NONE or _ended or bits_left or _codewords.holding();
+        if (not _done and _error == DecodeError::NONE and started) { _error = DecodeError::TRUNCATED; }
+        return _error;
+    }
+    // start decompressing a new stream from scratch, with new settings, reusing the storage of the old code table
+    void reset(DictionaryLimit limit = {}, CodewordPacking packing = CodewordPacking::BINARY, RedundantCodeElimination elimination = RedundantCodeElimination::IMMEDIATE, const PresetDictionary* preset = nullptr) {
+        _string_table.reset(limit, elimination, preset);
+        _codewords = CodewordSerialiser(packing);
+        _w = Table::NONE;
+        _adding = _prepared = _ended = _done = false;
+        _error = DecodeError::NONE;
+        _output_symbols = _input_bits = 0;
+        _reader = decltype(_reader)(nullptr, nullptr);
+        _pending.clear();
+        _pending_start = 0;
+        _writer = decltype(_writer)(std::back_inserter(_pending));
+        _finished = false;
+    }
+    // start decompressing a new stream after the final code of the last one, carrying on with the
+    // code table learnt so far, as the encoder did. not for the push-style interface
+    void restart() {
+        _w = Table::NONE;
+        _adding = _prepared = _ended = _done = false;
+        _error = DecodeError::NONE;
+        _output_symbols = _input_bits = 0;
+        _codewords.restart();
+        _string_table.drop_all_redundant_codes();
+    }
+    // decompress as much of input as there's room in output for.
+    // a code split across calls is held until the rest of it arrives, and the string for a code is
+    // held only for as long as output is full, so memory use doesn't depend on how much input there is.
+    Progress write(std::span<const std::byte> input, std::span<std::byte> output) {
+        Progress progress = {0, _drain(output)};
+        _reader.feed(input.data(), input.data() + input.size());
+        while (_pending.empty() and not _done) {
+            auto k = read_code(_reader);
+            if (not k) { break; } // wait for more input
+            decode(*k, _writer);
+            _writer.flush_whole_chars();
+            progress.produced += _drain(output.subspan(progress.produced));
+        }
+        progress.consumed = _reader.position() - input.data();
+        return progress;
+    }
+    // there's no more input to come, so send out the rest of the decompressed output, returning how many bytes were written.
+    // input that write() counted as consumed but held back undecoded while output was full is decoded now, and only what's
+    // left after the final code is padding. if output fills up, call again with more room until pending() is false.
+    std::size_t finish(std::span<std::byte> output) {
+        if (not _finished) {
+            // the last input given to write() mightn't be around any more, but all of it that was consumed is in the reader
+            _reader.feed(nullptr, nullptr);
+            while (not _done) {
+                auto k = read_code(_reader);
+                if (not k) { break; }
+                decode(*k, _writer);
+            }
+            end_of_input(not _reader.empty());
+            _writer.flush();
+            _done = _finished = true;
+        }
+        return _drain(output);
+    }
+    // whether there's decompressed output held back waiting for room
+    bool pending() const {
+        return not _pending.empty();
+    }
+    // whether the final code has been decoded, or an invalid one found
+    bool done() const {
+        return _done;
+    }
+
+private:
+    // counts a string of the given length as written out and a code as added if one's due,
+    // returning false (and stopping) if that goes beyond any of the limits
+    bool _within_limits(std::uint64_t length) {
+        _output_symbols += length;
+        if (_output_symbols > _max_output_symbols) { return _fail(DecodeError::OUTPUT_LIMIT); }
+        if (_adding and _string_table.entries() >= _max_entries) { return _fail(DecodeError::ENTRY_LIMIT); }
+        if (_limits.max_expansion != 0) {
+            constexpr std::uint64_t ALLOWANCE_BITS = DecodeLimits::EXPANSION_ALLOWANCE * 8;
+            std::uint64_t output_bits = _output_symbols * SYMBOL_BITS;
+            if (output_bits > ALLOWANCE_BITS and (output_bits - ALLOWANCE_BITS) / _limits.max_expansion > _input_bits) {
+                return _fail(DecodeError::EXPANSION_LIMIT);
+            }
+        }
+        return true;
+    }
+    bool _fail(DecodeError error) {
+        _error = error;
+        _done = true;
+        return false;
+    }
+    // writes out the string for the given node, followed by its first symbol again if repeat_first is set,
+    // and returns that first symbol. the string is never built --its symbols are packed into words back to
+    // front as they're found walking up the trie, then the words go out whole
+    template <class BitWriter>
+    typename Table::Symbol _emit(typename Table::Index node, bool repeat_first, BitWriter& output) {
+        LZW_BIT_STAT_TIMER(emit_time);
+        constexpr std::size_t WORD_BITS = 64;
+        std::size_t length = _string_table.length(node) + repeat_first;
+        std::size_t bits = length * SYMBOL_BITS;
+        // symbols evenly divide words, so none of them straddle two
+        _spelling.assign((bits + WORD_BITS - 1) / WORD_BITS, 0);
+        auto place = [&](std::size_t position, typename Table::Symbol c) {
+            std::size_t offset = position * SYMBOL_BITS;
+            _spelling[offset / WORD_BITS] |= (std::uint64_t)c << (WORD_BITS - SYMBOL_BITS - offset % WORD_BITS);
+        };
+        auto first = _string_table.spell_backwards(node, place);
+        if (repeat_first) { place(length - 1, first); }
+        for (std::size_t i = 0; i + 1 < _spelling.size(); ++i) {
+            output.put_bits(_spelling[i], WORD_BITS);
+        }
+        std::size_t rest = bits - (_spelling.size() - 1) * WORD_BITS;
+        output.put_bits(_spelling.back() >> (WORD_BITS - rest), rest);
+        return first;
+    }
+    // moves as much held-back output as will fit into the given buffer
+    std::size_t _drain(std::span<std::byte> output) {
+        std::size_t count = std::min(output.size(), _pending.size() - _pending_start);
+        std::copy_n((const std::byte*)_pending.data() + _pending_start, count, output.begin());
+        _pending_start += count;
+        if (_pending_start == _pending.size()) {
+            _pending.clear();
+            _pending_start = 0;
+        }
+        return count;
+    }
+
+    Table _string_table;
+    CodewordSerialiser _codewords;
+    // the string being written out, packed into words, kept around so that its storage gets reused
+    std::vector<std::uint64_t> _spelling;
+    // node for the previously decoded string, which the next code read extends
+    typename Table::Index _w = Table::NONE;
+    // whether a code gets added for w extended by the first symbol of the next string
+    bool _adding = false;
+    // whether the table has been made ready for the next code yet
+    bool _prepared = false;
+    // set once the "END" symbol is read, after which only one more code follows
+    bool _ended = false;
+    bool _done = false;
+    DecodeError _error = DecodeError::NONE;
+    // see set_limits(), and how much has been read and written against them
+    DecodeLimits _limits;
+    std::uint64_t _max_output_symbols = std::numeric_limits<std::uint64_t>::max();
+    std::size_t _max_entries = std::numeric_limits<std::size_t>::max();
+    std::uint64_t _output_symbols = 0;
+    std::uint64_t _input_bits = 0;
+    // only used by the push-style interface
+    bit_reader<const std::byte*> _reader{nullptr, nullptr};
+    std::vector<char> _pending;
+    std::size_t _pending_start = 0;
+    bit_writer<std::back_insert_iterator<std::vector<char>>> _writer{std::back_inserter(_pending)};
+    bool _finished = false;
+};
+
+// the engine can be chosen with e.g. lzw_bit_compress<8, HashChildren<8>>(...)
+template <std::size_t SYMBOL_BITS = 1, class Children = DefaultChildren<SYMBOL_BITS>, class InputIterator, class OutputIterator>
+OutputIterator lzw_bit_compress(InputIterator first, InputIterator last, OutputIterator result, DictionaryLimit limit = {}, CodewordPacking packing = CodewordPacking::BINARY, RedundantCodeElimination elimination = RedundantCodeElimination::IMMEDIATE, const PresetDictionary* preset = nullptr) {
+    LzwBitEncoder<SYMBOL_BITS, Children> encoder(limit, packing, elimination, preset);
+    bit_writer output(result);
+    for (; first != last; ++first) {
+        encoder.encode_byte((std::uint8_t)*first, output);
+    }
+    encoder.end(output);
+    // any unwritten partial-char bitstream gets padded out and written here
+    return output.flush();
+}
+
+template <std::size_t SYMBOL_BITS = 1, class Children = DefaultChildren<SYMBOL_BITS>, class InputIterator, class OutputIterator>
+OutputIterator lzw_bit_decompress(InputIterator first, InputIterator last, OutputIterator result, DictionaryLimit limit = {}, CodewordPacking packing = CodewordPacking::BINARY, RedundantCodeElimination elimination = RedundantCodeElimination::IMMEDIATE, const PresetDictionary* preset = nullptr) {
+    LzwBitDecoder<SYMBOL_BITS, Children> decoder(limit, packing, elimination, preset);
+    bit_reader input(first, last);
+    bit_writer output(result);
+    // if we don't get enough bits for a whole code, this is padding data and must be ignored
+    while (auto k = decoder.read_code(input)) {
+        if (not decoder.decode(*k, output)) { break; }
+    }
+    return output.flush();
+}
+
+// the same as lzw_bit_decompress(), for streams that can't be trusted: it stops as soon as the stream turns out
+// to be invalid or would go beyond any of the limits, and says which, rather than writing out whatever it can.
+// everything written before then is still written
+template <std::size_t SYMBOL_BITS = 1, class Children = DefaultChildren<SYMBOL_BITS>, class InputIterator, class OutputIterator>
+std::pair<OutputIterator, DecodeError> lzw_bit_decompress_checked(InputIterator first, InputIterator last, OutputIterator result, const DecodeLimits& limits, DictionaryLimit limit = {}, CodewordPacking packing = CodewordPacking::BINARY, RedundantCodeElimination elimination = RedundantCodeElimination::IMMEDIATE, const PresetDictionary* preset = nullptr) {
+    // a code table can't be built from a preset dictionary of another width, and one the limit leaves no room beyond would
+    // make each code cost as much as reloading the whole dictionary, which none of the limits would notice
+    if (preset and (preset->symbol_bits() != SYMBOL_BITS or not preset->leaves_room(limit))) { return {result, DecodeError::INVALID_HEADER}; }
+    LzwBitDecoder<SYMBOL_BITS, Children> decoder(limit, packing, elimination, preset);
+    decoder.set_limits(limits);
+    bit_reader input(first, last);
+    bit_writer output(result);
+    while (auto k = decoder.read_code(input)) {
+        if (not decoder.decode(*k, output)) { break; }
+    }
+    DecodeError error = decoder.end_of_input(not input.empty());
+    return {output.flush(), error};
+}
+
+// writes an unsigned integer to a byte stream big-endian, in the given number of bytes
+template <class OutputIterator>
+OutputIterator write_big_endian(OutputIterator result, std::uint64_t value, std::size_t bytes) {
+    for (std::size_t i = bytes; i > 0; --i) {
+        *result = (char)((value >> ((i - 1) * 8)) & 0xFF);
+        ++result;
+    }
+    return result;
+}
+
+// reads an unsigned integer big-endian from a byte stream, or nullopt if the stream runs out
+template <class InputIterator>
+std::optional<std::uint64_t> read_big_endian(InputIterator& first, InputIterator last, std::size_t bytes) {
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < bytes; ++i) {
+        if (first == last) { return std::nullopt; }
+        value = value << 8 | (std::uint8_t)*first;
+        ++first;
+    }
+    return value;
+}
+
+// everything the decompressor needs to know to mirror the compressor's settings
+// this is written byte-wise at the very start of a compressed stream, ahead of the codes
+struct StreamHeader {
+    static constexpr char MAGIC[4] = {'L', 'Z', 'W', 'b'};
+    // ADAPTIVE if the input was split into blocks, each compressed with whichever settings suited it best
+    // and starting with them (see write_settings()), in which case the rest of the settings here mean nothing
+    std::uint8_t symbol_bits = 1;
+    DictionaryLimit limit;
+    CodewordPacking packing = CodewordPacking::BINARY;
+    RedundantCodeElimination elimination = RedundantCodeElimination::IMMEDIATE;
+    // 0 if the codes for the whole input follow the header, else the input was
+    // split into independently compressed blocks of this many bytes
+    std::uint32_t block_size = 0;
+    // the id of the preset dictionary the code table starts from, or 0 if it starts from scratch
+    std::uint32_t dictionary_id = 0;
+    // the preset dictionary itself, which isn't written, so the decompressor has to be given it again
+    const PresetDictionary* preset = nullptr;
+
+    template <class OutputIterator>
+    OutputIterator write(OutputIterator result) const {
+        for (char c : MAGIC) {
+            *result = c;
+            ++result;
+        }
+        result = write_settings(result);
+        result = write_big_endian(result, block_size, 4);
+        return write_big_endian(result, dictionary_id, 4);
+    }
+    // writes just the settings the encoder and decoder need to agree on, which is also how each block
+    // of an adaptive file starts
+    template <class OutputIterator>
+    OutputIterator write_settings(OutputIterator result) const {
+        result = write_big_endian(result, symbol_bits, 1);
+        result = write_big_endian(result, (std::uint8_t)limit.policy, 1);
+        result = write_big_endian(result, (std::uint8_t)packing, 1);
+        result = write_big_endian(result, (std::uint8_t)elimination, 1);
+        return write_big_endian(result, limit.max_entries, 4);
+    }
+    // reads a header from the start of a stream, or nullopt if there isn't a valid one
+    template <class InputIterator>
+    static std::optional<StreamHeader> read(InputIterator& first, InputIterator last) {
+        for (char c : MAGIC) {
+            if (first == last or *first != c) { return std::nullopt; }
+            ++first;
+        }
+        StreamHeader header;
+        // only blocks can have settings of their own
+        if (not header.read_settings(first, last, true)) { return std::nullopt; }
+        auto block_size = read_big_endian(first, last, 4);
+        auto dictionary_id = read_big_endian(first, last, 4);
+        if (not dictionary_id) { return std::nullopt; }
+        if (header.symbol_bits == ADAPTIVE and *block_size == 0) { return std::nullopt; }
+        header.block_size = *block_size;
+        header.dictionary_id = *dictionary_id;
+        return header;
+    }
+    // reads the settings written by write_settings() into this header, returning false if they aren't valid
+    template <class InputIterator>
+    bool read_settings(InputIterator& first, InputIterator last, bool allow_adaptive = false) {
+        auto symbol_bits = read_big_endian(first, last, 1);
+        auto policy = read_big_endian(first, last, 1);
+        auto packing = read_big_endian(first, last, 1);
+        auto elimination = read_big_endian(first, last, 1);
+        auto max_entries = read_big_endian(first, last, 4);
+        if (not max_entries) { return false; }
+        if (*symbol_bits == ADAPTIVE ? not allow_adaptive : 8 % *symbol_bits != 0) { return false; }
+        if (*policy > (std::uint8_t)DictionaryPolicy::PRUNE) { return false; }
+        if (*packing > (std::uint8_t)CodewordPacking::DENSE) { return false; }
+        if (*elimination > (std::uint8_t)RedundantCodeElimination::NONE) { return false; }
+        this->symbol_bits = *symbol_bits;
+        limit = {(DictionaryPolicy)*policy, *max_entries};
+        this->packing = (CodewordPacking)*packing;
+        this->elimination = (RedundantCodeElimination)*elimination;
+        return true;
+    }
+    // whether the given preset dictionary (or lack of one) is the one the stream needs
+    bool matches(const PresetDictionary* dictionary) const {
+        return dictionary_id == (dictionary ? dictionary->id() : 0);
+    }
+    // whether the dictionary limit leaves the code table room to learn anything beyond the given preset dictionary
+    bool leaves_room(const PresetDictionary* dictionary) const {
+        return symbol_bits == ADAPTIVE or dictionary == nullptr or dictionary->leaves_room(limit);
+    }
+    // whether a stream with this header can be decompressed starting from the given preset dictionary (or none),
+    // returning why not if it can't. every decoder checks this before building a code table from the settings
+    DecodeError check(const PresetDictionary* dictionary) const {
+        if (not matches(dictionary)) { return DecodeError::WRONG_DICTIONARY; }
+        // the id is only a hash, so a stream can name the right dictionary with the wrong width
+        if (dictionary and symbol_bits != ADAPTIVE and dictionary->symbol_bits() != symbol_bits) { return DecodeError::INVALID_HEADER; }
+        if (not leaves_room(dictionary)) { return DecodeError::INVALID_HEADER; }
+        return DecodeError::NONE;
+    }
+    // how many bytes the header takes up, and the settings within it
+    static constexpr std::size_t SIZE = 20;
+    static constexpr std::size_t SETTINGS_SIZE = 8;
+    static constexpr std::uint8_t ADAPTIVE = 0;
+};
+
+#include <type_traits>
+
+// calls the given function with the symbol width as a compile-time constant,
+// so that it can pick the matching instantiation of the engine
+template <class Function>
+void with_symbol_bits(std::size_t symbol_bits, Function function) {
+    switch (symbol_bits) {
+    case 1: function(std::integral_constant<std::size_t, 1>()); break;
+    case 2: function(std::integral_constant<std::size_t, 2>()); break;
+    case 4: function(std::integral_constant<std::size_t, 4>()); break;
+    case 8: function(std::integral_constant<std::size_t, 8>()); break;
+    }
+}
+
+#include <cstddef>
+#include <iterator>
+
+// the library interface, for compressing and decompressing whole buffers in memory.
+// what comes out is exactly what `lzw_bit c` writes for a single stream, header and all
+namespace lzw_bit {
+
+// output iterator writing chars into a fixed-size buffer, which stops at the end of it
+// and notes that there was more, rather than overrunning it
+struct span_output_iterator {
+    using iterator_category = std::output_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = void;
+    using pointer = void;
+    using reference = void;
+
+    span_output_iterator& operator=(char c) {
+        if (position == end) {
+            overflowed = true;
+        } else {
+            *position++ = (std::byte)c;
+        }
+        return *this;
+    }
+    // just like std::ostreambuf_iterator, these are provided only to satisfy LegacyOutputIterator requirements
+    span_output_iterator& operator*() {
+        return *this;
+    }
+    span_output_iterator& operator++() {
+        return *this;
+    }
+    span_output_iterator& operator++(int) {
+        return *this;
+    }
+
+    std::byte* position;
+    std::byte* end;
+    bool overflowed = false;
+};
+
+// whether compress() can compress with these settings, and decompress() can decompress a stream with them in its
+// header: a single stream at one of the symbol widths, starting from a preset dictionary of that width if any.
+// blocks, and adaptive settings chosen for each one, are only for the command line's files
+inline bool supported(const StreamHeader& settings) {
+    bool width = settings.symbol_bits == 1 or settings.symbol_bits == 2 or settings.symbol_bits == 4 or settings.symbol_bits == 8;
+    return width and settings.block_size == 0 and (not settings.preset or settings.preset->symbol_bits() == settings.symbol_bits);
+}
+
+// the most that compressing this many bytes with the given settings can possibly come to, header included,
+// so an output buffer this big always has room, or 0 if the settings aren't supported(). with no limit on the table,
+// every codeword but the last adds a string to the table one symbol longer than its own, and there are only so many
+// strings of each length, so most codewords have to stand for several symbols. with a limit, they could all stand for just one
+inline std::size_t compress_bound(std::size_t size, const StreamHeader& settings = {}) {
+    if (not supported(settings)) { return 0; }
+    std::uint64_t alphabet_size = (std::uint64_t)1 << settings.symbol_bits;
+    std::uint64_t symbols = (std::uint64_t)size * 8 / settings.symbol_bits;
+    std::uint64_t initial_entries = alphabet_size + (settings.preset ? settings.preset->size() : 0);
+    std::uint64_t codewords = symbols;
+    std::uint64_t entries = initial_entries + codewords;
+    if (settings.limit.policy == DictionaryPolicy::UNBOUNDED) {
+        // as many codewords as possible, by making each as short as there are strings for
+        codewords = 0;
+        std::uint64_t remaining = symbols;
+        std::uint64_t strings = alphabet_size;
+        for (std::uint64_t length = 1; remaining >= length; ++length) {
+            // there's no point counting any higher than there are symbols left to go round
+            if (strings <= remaining) { strings *= alphabet_size; }
+            std::uint64_t count = std::min(strings, remaining / length);
+            codewords += count;
+            remaining -= count * length;
+        }
+        codewords += remaining > 0;
+        entries = initial_entries + codewords;
+    } else {
+        entries = std::min<std::uint64_t>(entries, std::max<std::uint64_t>(settings.limit.max_entries, initial_entries));
+    }
+    // +1 for the "END" code, and each is out of at most the whole table, "END" and the code being added
+    std::uint64_t bits = (codewords + 1) * bits_needed(entries + 2);
+    // the range coder loses a tiny fraction of a bit per codeword, then flushes out its last few bytes
+    if (settings.packing == CodewordPacking::DENSE) { bits += codewords + 1 + 6 * 8; }
+    return StreamHeader::SIZE + (bits + 7) / 8;
+}
+
+// what Decompressor::decompress_checked() managed to do
+struct DecodeResult {
+    std::size_t size = 0; // how many bytes were written to output, which is all of them if there was no error
+    DecodeError error = DecodeError::NONE;
+};
+
+// a reusable compressor, which keeps the storage of its code table from one call to the next,
+// so that compressing lots of small buffers doesn't keep allocating it all over again
+template <std::size_t SYMBOL_BITS = 1, class Children = DefaultChildren<SYMBOL_BITS>>
+class Compressor {
+public:
+    // the settings' preset dictionary, if any, must outlive the compressor
+    Compressor(const StreamHeader& settings = {}) : _settings(settings),
+      _encoder(settings.limit, settings.packing, settings.elimination, settings.preset) {
+        _settings.symbol_bits = SYMBOL_BITS;
+        _settings.block_size = 0;
+        _settings.dictionary_id = settings.preset ? settings.preset->id() : 0;
+    }
+
+    // compresses all of input into the start of output, returning how many bytes that took,
+    // or nullopt if it didn't fit. it always fits in compress_bound(input.size(), settings)
+    std::optional<std::size_t> compress(std::span<const std::byte> input, std::span<std::byte> output) {
+        if (_used) { _encoder.reset(_settings.limit, _settings.packing, _settings.elimination, _settings.preset); }
+        _used = true;
+        bit_writer writer(_settings.write(span_output_iterator{output.data(), output.data() + output.size()}));
+        for (std::byte byte : input) {
+            _encoder.encode_byte((std::uint8_t)byte, writer);
+        }
+        _encoder.end(writer);
+        auto result = writer.flush();
+        if (result.overflowed) { return std::nullopt; }
+        return result.position - output.data();
+    }
+
+private:
+    StreamHeader _settings;
+    LzwBitEncoder<SYMBOL_BITS, Children> _encoder;
+    bool _used = false;
+};
+
+// a reusable decompressor, which keeps the storage of its code table from one call to the next.
+// it takes its settings from each stream it's given, which must have the same symbol width as it
+template <std::size_t SYMBOL_BITS = 1, class Children = DefaultChildren<SYMBOL_BITS>>
+class Decompressor {
+public:
+    // the preset dictionary, if any, must outlive the decompressor, and is the only one it can decompress with.
+    // the limits apply to every stream it decompresses, on top of the size of the output buffer
+    Decompressor(const PresetDictionary* preset = nullptr, const DecodeLimits& limits = {}) : _preset(preset), _limits(limits) {}
+
+    // decompresses all of input into the start of output, returning how many bytes came out, or nullopt if input
+    // isn't a whole stream this can decompress or there wasn't room for all of it in output
+    std::optional<std::size_t> decompress(std::span<const std::byte> input, std::span<std::byte> output) {
+        auto result = decompress_checked(input, output);
+        if (result.error != DecodeError::NONE) { return std::nullopt; }
+        return result.size;
+    }
+    // the same, but saying why it failed, if it did. decoding stops as soon as output is full,
+    // so however much a stream would expand to, it's only ever decoded as far as there's room for
+    DecodeResult decompress_checked(std::span<const std::byte> input, std::span<std::byte> output) {
+        const char* first = (const char*)input.data();
+        const char* last = first + input.size();
+        auto header = StreamHeader::read(first, last);
+        if (not header or header->symbol_bits != SYMBOL_BITS or header->block_size != 0) { return {0, DecodeError::INVALID_HEADER}; }
+        if (DecodeError error = header->check(_preset); error != DecodeError::NONE) { return {0, error}; }
+        _decoder.reset(header->limit, header->packing, header->elimination, _preset);
+        DecodeLimits limits = _limits;
+        // 0 would mean no limit, and an empty buffer overflows with the first byte anyway
+        bool buffer_bound = limits.max_output == 0 or limits.max_output > output.size();
+        if (buffer_bound) { limits.max_output = std::max<std::size_t>(output.size(), 1); }
+        _decoder.set_limits(limits);
+        bit_reader reader(first, last);
+        bit_writer writer(span_output_iterator{output.data(), output.data() + output.size()});
+        while (auto k = _decoder.read_code(reader)) {
+            if (not _decoder.decode(*k, writer)) { break; }
+        }
+        DecodeError error = _decoder.end_of_input(not reader.empty());
+        auto result = writer.flush();
+        if (result.overflowed or (buffer_bound and error == DecodeError::OUTPUT_LIMIT)) { error = DecodeError::OUTPUT_FULL; }
+        return {(std::size_t)(result.position - output.data()), error};
+    }
+
+private:
+    const PresetDictionary* _preset;
+    DecodeLimits _limits;
+    LzwBitDecoder<SYMBOL_BITS, Children> _decoder;
+};
+
+// compresses input into output with a compressor used just the once, see Compressor::compress().
+// also returns nullopt if the settings aren't supported()
+inline std::optional<std::size_t> compress(std::span<const std::byte> input, std::span<std::byte> output, const StreamHeader& settings = {}) {
+    if (not supported(settings)) { return std::nullopt; }
+    std::optional<std::size_t> size;
+    with_symbol_bits(settings.symbol_bits, [&](auto bits) {
+        Compressor<bits> compressor(settings);
+        size = compressor.compress(input, output);
+    });
+    return size;
+}
+
+// decompresses input into output with a decompressor used just the once, see Decompressor::decompress()
+inline std::optional<std::size_t> decompress(std::span<const std::byte> input, std::span<std::byte> output, const PresetDictionary* preset = nullptr) {
+    const char* first = (const char*)input.data();
+    auto header = StreamHeader::read(first, first + input.size());
+    if (not header or not supported(*header)) { return std::nullopt; }
+    std::optional<std::size_t> size;
+    with_symbol_bits(header->symbol_bits, [&](auto bits) {
+        Decompressor<bits> decompressor(preset);
+        size = decompressor.decompress(input, output);
+    });
+    return size;
+}
+
+// decompresses input into output with a decompressor used just the once, see Decompressor::decompress_checked()
+inline DecodeResult decompress_checked(std::span<const std::byte> input, std::span<std::byte> output, const DecodeLimits& limits = {}, const PresetDictionary* preset = nullptr) {
+    const char* first = (const char*)input.data();
+    auto header = StreamHeader::read(first, first + input.size());
+    DecodeResult result = {0, DecodeError::INVALID_HEADER};
+    if (not header or not supported(*header)) { return result; }
+    with_symbol_bits(header->symbol_bits, [&](auto bits) {
+        Decompressor<bits> decompressor(preset, limits);
+        result = decompressor.decompress_checked(input, output);
+    });
+    return result;
+}
+
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <system_error>
+
+#include <cerrno>
+#include <cstddef>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a whole file mapped read-only into memory, so that it can be read as one
+// contiguous range of chars straight out of the page cache
+class MappedInputFile {
+public:
+    MappedInputFile(const char* path) {
+        _fd = ::open(path, O_RDONLY);
+        if (_fd == -1) { return; }
+        struct stat info;
+        if (::fstat(_fd, &info) == -1) {
+            close();
+            return;
+        }
+        _size = info.st_size;
+        // mmap() refuses empty mappings, but an empty file is still a perfectly good file
+        if (_size == 0) { return; }
+        void* data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+        if (data == MAP_FAILED) {
+            close();
+            return;
+        }
+        _data = (const char*)data;
+        // we only ever read front to back, so let the kernel read ahead aggressively
+        ::madvise(data, _size, MADV_SEQUENTIAL);
+    }
+    ~MappedInputFile() {
+        close();
+    }
+    // non-copyable, as it owns the mapping
+    MappedInputFile(const MappedInputFile&) = delete;
+    MappedInputFile& operator=(const MappedInputFile&) = delete;
+
+    bool is_open() const {
+        return _fd != -1;
+    }
+    const char* begin() const {
+        return _data;
+    }
+    const char* end() const {
+        return _data + _size;
+    }
+    std::size_t size() const {
+        return _size;
+    }
+    void close() {
+        if (_data != nullptr) { ::munmap((void*)_data, _size); }
+        if (_fd != -1) { ::close(_fd); }
+        _data = nullptr;
+        _fd = -1;
+        _size = 0;
+    }
+
+private:
+    int _fd = -1;
+    const char* _data = nullptr;
+    std::size_t _size = 0;
+};
+
+// a file written through a shared memory mapping, which is grown as needed
+// and truncated to the number of chars actually written when it's closed
+class MappedOutputFile {
+public:
+    // output iterator for writing chars to the end of the file
+    // analogous to std::ostreambuf_iterator
+    struct iterator {
+        using iterator_category = std::output_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = void;
+        using pointer = void;
+        using reference = void;
+
+        iterator& operator=(char c) {
+            _file->put(c);
+            return *this;
+        }
+        // just like std::ostreambuf_iterator, these are provided only to satisfy LegacyOutputIterator requirements
+        iterator& operator*() {
+            return *this;
+        }
+        iterator& operator++() {
+            return *this;
+        }
+        iterator& operator++(int) {
+            return *this;
+        }
+
+        MappedOutputFile* _file;
+    };
+
+    // capacity is how big the file is made to start with, it is doubled whenever it runs out
+    MappedOutputFile(const char* path, std::size_t capacity) {
+        _fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (_fd == -1) { return; }
+        if (not _map(std::max<std::size_t>(capacity, MINIMUM_CAPACITY))) { close(); }
+    }
+    ~MappedOutputFile() {
+        close();
+    }
+    // non-copyable, as it owns the mapping
+    MappedOutputFile(const MappedOutputFile&) = delete;
+    MappedOutputFile& operator=(const MappedOutputFile&) = delete;
+
+    bool is_open() const {
+        return _fd != -1;
+    }
+    iterator writer() {
+        return {this};
+    }
+    void put(char c) {
+        if (_size == _capacity) { _grow(); }
+        _data[_size++] = c;
+    }
+    std::size_t size() const {
+        return _size;
+    }
+    // unmaps the file and cuts it down to what has actually been written
+    void close() {
+        if (_data != nullptr) { ::munmap(_data, _capacity); }
+        if (_fd != -1) {
+            // not much to be done if this fails --the file is left with trailing zeros
+            [[maybe_unused]] int result = ::ftruncate(_fd, _size);
+            ::close(_fd);
+        }
+        _data = nullptr;
+        _fd = -1;
+        _capacity = 0;
+    }
+
+private:
+    bool _map(std::size_t capacity) {
+        if (::ftruncate(_fd, capacity) == -1) { return false; }
+        void* data = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if (data == MAP_FAILED) { return false; }
+        _data = (char*)data;
+        _capacity = capacity;
+        return true;
+    }
+    void _grow() {
+        std::size_t capacity = _capacity * 2;
+        ::munmap(_data, _capacity);
+        _data = nullptr;
+        if (not _map(capacity)) {
+            throw std::system_error(errno, std::generic_category(), "couldn't grow mapped output file");
+        }
+    }
+
+    static constexpr std::size_t MINIMUM_CAPACITY = 1 << 20;
+    int _fd = -1;
+    char* _data = nullptr;
+    std::size_t _size = 0;
+    std::size_t _capacity = 0;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+
+// fixed-capacity queue between exactly one producing thread and one consuming thread.
+// pushing and popping are lock-free, each side only ever writes its own index, and a side only
+// sleeps (on the other's index) when the queue is empty or full
+template <class T>
+class SpscRing {
+public:
+    // capacity must be a power of two
+    SpscRing(std::size_t capacity) : _slots(capacity) {}
+    // non-copyable, as both threads refer to the one ring
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // producer only. waits for room if the queue is full
+    void push(T value) {
+        std::size_t tail = _tail.load(std::memory_order_relaxed);
+        std::size_t head;
+        while (tail - (head = _head.load(std::memory_order_acquire)) == _slots.size()) {
+            _head.wait(head, std::memory_order_acquire);
+        }
+        _slots[tail & (_slots.size() - 1)] = std::move(value);
+        _tail.store(tail + 1, std::memory_order_release);
+        _tail.notify_one();
+    }
+    // consumer only. waits for something to be pushed if the queue is empty
+    T pop() {
+        std::size_t head = _head.load(std::memory_order_relaxed);
+        std::size_t tail;
+        while ((tail = _tail.load(std::memory_order_acquire)) == head) {
+            _tail.wait(tail, std::memory_order_acquire);
+        }
+        T value = std::move(_slots[head & (_slots.size() - 1)]);
+        _head.store(head + 1, std::memory_order_release);
+        _head.notify_one();
+        return value;
+    }
+
+private:
+    std::vector<T> _slots;
+    // how many values have ever been popped and pushed, each only written by its own side
+    // and kept on separate cache lines so that the two sides don't keep stealing them from each other
+    alignas(64) std::atomic<std::size_t> _head = 0;
+    alignas(64) std::atomic<std::size_t> _tail = 0;
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+// optional instrumentation of the engine, for finding out where time and memory go
+// this is only compiled in when LZW_BIT_STATS is defined, otherwise every LZW_BIT_STAT()
+// and LZW_BIT_STAT_TIMER() vanishes and the engine is exactly as fast as without it
+#ifdef LZW_BIT_STATS
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+struct Statistics {
+    using Duration = std::chrono::steady_clock::duration;
+
+    // how many codewords were written or read at each width, i.e. ceil(log2(how many were possible))
+    std::array<std::uint64_t, 65> codewords_by_width = {};
+    // redundant code elimination
+    std::uint64_t codes_shadowed = 0;
+    std::uint64_t codes_dropped = 0;
+    std::uint64_t codes_restored = 0;
+    // codes taken out of the numbering, whether dropped as redundant, pruned or by CodeTable::operator-=, and how many
+    // cells of the rank/select tree were updated by any change to which nodes are coded, which is what renumbering costs
+    std::uint64_t uncodes = 0;
+    std::uint64_t renumbering_steps = 0;
+    // how many nodes were added to the trie at each depth
+    std::map<std::size_t, std::uint64_t> depths;
+    // codewords written or read, and the total length of the strings they stood for
+    std::uint64_t matches = 0;
+    std::uint64_t matched_symbols = 0;
+    // the most memory any one code table took up
+    std::uint64_t peak_dictionary_bytes = 0;
+    // time spent in each phase, summed over all threads
+    Duration emit_time = {};
+    Duration dictionary_time = {};
+    Duration rce_time = {};
+    Duration io_time = {};
+    // whether any of the above were counted on threads that have since finished. their phases overlap each other,
+    // so add up to CPU time rather than wall-clock time, and can come to more than the whole run took
+    bool merged = false;
+
+    Statistics& operator+=(const Statistics& other) {
+        for (std::size_t i = 0; i < codewords_by_width.size(); ++i) {
+            codewords_by_width[i] += other.codewords_by_width[i];
+        }
+        codes_shadowed += other.codes_shadowed;
+        codes_dropped += other.codes_dropped;
+        codes_restored += other.codes_restored;
+        uncodes += other.uncodes;
+        renumbering_steps += other.renumbering_steps;
+        for (auto [depth, count] : other.depths) { depths[depth] += count; }
+        matches += other.matches;
+        matched_symbols += other.matched_symbols;
+        peak_dictionary_bytes = std::max(peak_dictionary_bytes, other.peak_dictionary_bytes);
+        emit_time += other.emit_time;
+        dictionary_time += other.dictionary_time;
+        rce_time += other.rce_time;
+        io_time += other.io_time;
+        merged = merged or other.merged;
+        return *this;
+    }
+    // total is the wall-clock time of the whole run. on one thread, whatever isn't accounted for by the other
+    // phases is put down to matching, which when compressing is mostly walking the trie. on several it's left out,
+    // as the phases are summed over all of them
+    std::string json(Duration total) const {
+        auto seconds = [](Duration duration) { return std::chrono::duration<double>(duration).count(); };
+        std::ostringstream out;
+        out << "{\n  \"codewords_by_width\": {";
+        const char* separator = "";
+        for (std::size_t width = 0; width < codewords_by_width.size(); ++width) {
+            if (codewords_by_width[width] == 0) { continue; }
+            out << separator << "\"" << width << "\": " << codewords_by_width[width];
+            separator = ", ";
+        }
+        out << "},\n  \"codes_shadowed\": " << codes_shadowed << ",\n  \"codes_dropped\": " << codes_dropped
+            << ",\n  \"codes_restored\": " << codes_restored << ",\n  \"uncodes\": " << uncodes
+            << ",\n  \"renumbering_steps\": " << renumbering_steps << ",\n  \"trie_depths\": {";
+        separator = "";
+        for (auto [depth, count] : depths) {
+            out << separator << "\"" << depth << "\": " << count;
+            separator = ", ";
+        }
+        out << "},\n  \"matches\": " << matches << ",\n  \"average_match_length\": "
+            << (matches == 0 ? 0.0 : (double)matched_symbols / matches)
+            << ",\n  \"peak_dictionary_bytes\": " << peak_dictionary_bytes << ",\n  \"seconds\": {"
+            << "\"total\": " << seconds(total);
+        if (not merged) { out << ", \"match\": " << seconds(total - emit_time - dictionary_time - rce_time - io_time); }
+        out << ", \"emit\": " << seconds(emit_time) << ", \"dictionary\": " << seconds(dictionary_time)
+            << ", \"rce\": " << seconds(rce_time) << ", \"io\": " << seconds(io_time) << "}\n}";
+        return out.str();
+    }
+};
+
+// each thread counts into its own statistics, so as not to contend over them,
+// and adds them to the global total when it finishes
+struct ThreadStatistics : Statistics {
+    static std::mutex& mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+    static Statistics& total() {
+        static Statistics total;
+        return total;
+    }
+    ~ThreadStatistics() {
+        std::lock_guard lock(mutex());
+        total() += *this;
+        total().merged = true;
+    }
+};
+
+inline ThreadStatistics& statistics() {
+    thread_local ThreadStatistics local;
+    return local;
+}
+
+// everything counted so far, by threads that have finished and the calling one
+inline Statistics total_statistics() {
+    std::lock_guard lock(ThreadStatistics::mutex());
+    Statistics total = ThreadStatistics::total();
+    total += statistics();
+    return total;
+}
+
+// adds the time from construction to destruction to a phase
+class PhaseTimer {
+public:
+    PhaseTimer(Statistics::Duration& phase) : _phase(phase), _start(std::chrono::steady_clock::now()) {}
+    ~PhaseTimer() {
+        _phase += std::chrono::steady_clock::now() - _start;
+    }
+
+private:
+    Statistics::Duration& _phase;
+    std::chrono::steady_clock::time_point _start;
+};
+
+#define LZW_BIT_STAT(statement) statement
+// times the rest of the enclosing scope as part of the given phase
+#define LZW_BIT_STAT_TIMER(phase) PhaseTimer _phase_timer(statistics().phase)
+
+#else
+
+#define LZW_BIT_STAT(statement)
+#define LZW_BIT_STAT_TIMER(phase)
+
+#endif